@@ -0,0 +1,145 @@
+﻿/**
+ * @file Boundaries.h
+ * @brief Inlet and outlet edge kernels shared by the solvers
+ *
+ * The kernels run on one edge cell after streaming and rebuild the populations
+ * that point into the domain:
+ * - Zou-He velocity inlet (west edge)
+ * - Zou-He pressure outlet (east edge)
+ * - Convective outflow, df/dt + U df/dx = 0 (east edge)
+ *
+ * An optional sponge layer in front of the outlet blends the post-collision
+ * populations towards the far-field equilibrium. The blend rate ramps from zero
+ * to `strength` across the layer, which damps vortices and acoustic waves before
+ * they reach the edge. Only the sponge columns are visited.
+ *
+ * Populations are lane-interleaved (`f[k][cell * L + lane]`), and the inner lane
+ * loop vectorizes. FastAirLBM calls them with L = 1 and EnsembleLBM with its lane
+ * count.
+ */
+
+#pragma once
+
+#include "Lattice.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Populations unknown after streaming: entering from the west (ex = +1) and east (ex = -1)
+const int InletUnknown[3] = {1, 5, 8};
+const int OutletUnknown[3] = {3, 6, 7};
+
+// Zou-He velocity inlet with u = (u_x, 0). Density follows from the known populations.
+template <int L>
+inline void ZouHeVelocityInlet(float* const* f, size_t base, const float* u) {
+    float *f0 = f[0] + base, *f1 = f[1] + base, *f2 = f[2] + base, *f3 = f[3] + base, *f4 = f[4] + base;
+    float *f5 = f[5] + base, *f6 = f[6] + base, *f7 = f[7] + base, *f8 = f[8] + base;
+    for (int l = 0; l < L; l++) {
+        float density = (f0[l] + f2[l] + f4[l] + 2.0f * (f3[l] + f6[l] + f7[l])) / (1.0f - u[l]);
+        float ru = density * u[l];
+        float half_diff = 0.5f * (f2[l] - f4[l]);
+        f1[l] = f3[l] + (2.0f / 3.0f) * ru;
+        f5[l] = f7[l] - half_diff + ru / 6.0f;
+        f8[l] = f6[l] + half_diff + ru / 6.0f;
+    }
+}
+
+// Zou-He pressure outlet at density rho_out with zero tangential velocity
+template <int L>
+inline void ZouHePressureOutlet(float* const* f, size_t base, float rho_out) {
+    float *f0 = f[0] + base, *f1 = f[1] + base, *f2 = f[2] + base, *f3 = f[3] + base, *f4 = f[4] + base;
+    float *f5 = f[5] + base, *f6 = f[6] + base, *f7 = f[7] + base, *f8 = f[8] + base;
+    for (int l = 0; l < L; l++) {
+        float u = (f0[l] + f2[l] + f4[l] + 2.0f * (f1[l] + f5[l] + f8[l])) / rho_out - 1.0f;
+        float ru = rho_out * u;
+        float half_diff = 0.5f * (f2[l] - f4[l]);
+        f3[l] = f1[l] - (2.0f / 3.0f) * ru;
+        f7[l] = f5[l] + half_diff - ru / 6.0f;
+        f6[l] = f8[l] - half_diff - ru / 6.0f;
+    }
+}
+
+// Convective outflow: the unknown populations are advected out at the local normal
+// velocity u of the neighbouring cell (clamped to [0, 1]). `prev` holds their
+// values from the previous step (3 * L floats) and is updated in place.
+template <int L>
+inline void ConvectiveOutlet(float* const* f, size_t out, size_t in, const float* u, float* prev) {
+    for (int j = 0; j < 3; j++) {
+        float* fo = f[OutletUnknown[j]] + out;
+        const float* fi = f[OutletUnknown[j]] + in;
+        float* p = prev + j * L;
+        for (int l = 0; l < L; l++) {
+            float lambda = std::clamp(u[l], 0.0f, 1.0f);
+            fo[l] = (p[l] + lambda * fi[l]) / (1.0f + lambda);
+            p[l] = fo[l];
+        }
+    }
+}
+
+// Zero-gradient outlet: copies every population from the neighbouring cell
+template <int L>
+inline void CopyOutlet(float* const* f, size_t out, size_t in) {
+    for (int k = 0; k < Q; k++) std::memcpy(f[k] + out, f[k] + in, L * sizeof(float));
+}
+
+// Blend rate per sponge column, rising from ~0 at the inner end to `strength` at the outlet
+inline std::vector<float> SpongeRates(int thickness, float strength, SpongeProfile profile) {
+    std::vector<float> rates(std::max(0, thickness));
+    for (int i = 0; i < thickness; i++) {
+        float s = (i + 1.0f) / thickness;
+        float shape = s;
+        if (profile == SpongeProfile::Quadratic) shape = s * s;
+        else if (profile == SpongeProfile::Cubic) shape = s * s * s;
+        else if (profile == SpongeProfile::Cosine) shape = 0.5f * (1.0f - std::cos(3.14159265f * s));
+        rates[i] = strength * shape;
+    }
+    return rates;
+}
+
+// f += rate * (target - f) for one cell; `target` holds the far-field equilibrium [Q][L]
+template <int L>
+inline void SpongeRelax(float* const* f, size_t base, float rate, const float* target) {
+    for (int k = 0; k < Q; k++) {
+        float* fk = f[k] + base;
+        const float* t = target + k * L;
+        for (int l = 0; l < L; l++) fk[l] += rate * (t[l] - fk[l]);
+    }
+}
+
+inline const char* InletTypeName(InletType type) {
+    return type == InletType::ZouHe ? "zouhe" : "equilibrium";
+}
+
+inline const char* OutletTypeName(OutletType type) {
+    switch (type) {
+    case OutletType::Pressure: return "pressure";
+    case OutletType::Convective: return "convective";
+    default: return "copy";
+    }
+}
+
+inline bool ParseSpongeProfile(const std::string& name, SpongeProfile& profile) {
+    if (name == "linear") profile = SpongeProfile::Linear;
+    else if (name == "quadratic") profile = SpongeProfile::Quadratic;
+    else if (name == "cubic") profile = SpongeProfile::Cubic;
+    else if (name == "cosine") profile = SpongeProfile::Cosine;
+    else return false;
+    return true;
+}
+
+inline bool ParseInletType(const std::string& name, InletType& type) {
+    if (name == "equilibrium") type = InletType::Equilibrium;
+    else if (name == "zouhe") type = InletType::ZouHe;
+    else return false;
+    return true;
+}
+
+inline bool ParseOutletType(const std::string& name, OutletType& type) {
+    if (name == "copy") type = OutletType::Copy;
+    else if (name == "pressure") type = OutletType::Pressure;
+    else if (name == "convective") type = OutletType::Convective;
+    else return false;
+    return true;
+}
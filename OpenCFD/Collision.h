@@ -0,0 +1,330 @@
+﻿/**
+ * @file Collision.h
+ * @brief BGK, TRT, MRT and central-moment collision operators as compile-time policies
+ *
+ * Each operator is a struct with a static `Relax<L>` kernel that relaxes one
+ * cell towards equilibrium in place. The solvers template their collision loop
+ * on the operator and pick the instantiation once per step, so the chosen
+ * kernel is inlined into the fused loop and nothing is dispatched per cell.
+ *
+ * - BGK: one rate, omega = 1 / tau.
+ * - TRT: the even part of each opposite pair relaxes at 1 / tau and the odd
+ *   part at a fixed 1 / 0.6. Keeping the "magic" parameter
+ *   (tau - 1/2)(tau_odd - 1/2) at 3/16 would put bounce-back walls at the same
+ *   place for every tau, but tau_odd then grows without bound as tau approaches
+ *   0.5, the odd modes stop damping the checkerboard the equilibrium inlet
+ *   excites, and TRT would need tau >= 0.54. With tau_odd fixed it shares BGK's
+ *   floor of 0.51 and gains no Re range; wall placement depends on tau as in BGK.
+ * - MRT: Lallemand-Luo moment basis. The stress moments relax at 1 / tau and
+ *   the energy, energy-square and heat-flux moments at fixed rates (1.64, 1.54,
+ *   1.9). The extra bulk damping is what keeps runs stable down to tau = 0.502.
+ * - Central moments: the moments are taken in the frame moving with the
+ *   fluid, so the relaxation is Galilean invariant. The deviatoric stress
+ *   relaxes at 1 / tau, the trace (bulk) at 1, and the third- and fourth-order
+ *   central moments are set to equilibrium. With those rates only the second
+ *   order is needed, and the kernel is about as cheap as BGK.
+ *
+ * BGK, TRT and MRT use the same second-order equilibrium, so with every rate
+ * set to 1 / tau TRT and MRT reduce to BGK.
+ *
+ * `Smagorinsky<Op>` wraps any operator with the Smagorinsky subgrid model. It
+ * reads the non-equilibrium momentum flux of the cell, solves for the local tau
+ * that includes the eddy viscosity (Cs dx)^2 |S|, and hands the local rates to
+ * the wrapped kernel. The populations are still in registers or L1 at that
+ * point, so the model adds arithmetic but no pass over memory. If the rates
+ * carry an eddy-viscosity buffer, the applied nu_t = (tau_local - tau) / 3 is
+ * stored there in the same pass.
+ *
+ * `GuoForce` adds a body force after any of them (Guo, Zheng & Shi 2002). The
+ * solvers already shift the velocity by F / 2 rho when taking moments, so the
+ * operators relax towards the forced equilibrium. The source term then
+ * (a) tops the cell momentum up to rho u + F / 2, whatever the operator did to
+ * the first moment, and (b) adds the second-order part (1 - omega / 2) w_k
+ * [9 (e.u)(e.F) - 3 u.F] to the stress. For BGK that is exactly Guo's term;
+ * for the others it is Guo's term with the shear moments at their own rate.
+ *
+ * `LimitPositivity` is an optional cell-local limiter run after any of them.
+ * If relaxation left a population negative, it scales the non-equilibrium
+ * part f - feq by the largest factor that keeps every population >= 0. Mass
+ * and momentum are untouched because f - feq carries neither (apart from the
+ * F / 2 of a forced cell). Populations use the lane-interleaved layout of
+ * Boundaries.h (`f[k][cell * L + lane]`), with L = 1 for FastAirLBM.
+ */
+
+#pragma once
+
+#include "Lattice.h"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <string>
+
+// Relaxation rates per lane, derived from tau
+template <int L>
+struct CollisionRates {
+    alignas(64) float tau[L];       // Molecular relaxation time
+    alignas(64) float omega[L];     // Shear rate 1 / tau
+    alignas(64) float omega_odd[L]; // TRT odd rate, fixed at 1 / 0.6
+    float smagorinsky = 0.0f;       // 18 sqrt(2) Cs^2, 0 without the subgrid model
+    float* eddy_viscosity = nullptr; // Optional output: nu_t the subgrid model applied [cell * L + lane]
+
+    void Set(int lane, float lane_tau) {
+        const float tau_odd = 0.6f; // Keeps the odd modes damped as tau -> 1/2
+        tau[lane] = lane_tau;
+        omega[lane] = 1.0f / lane_tau;
+        omega_odd[lane] = 1.0f / tau_odd;
+    }
+
+    void SetSmagorinsky(float cs) { smagorinsky = 18.0f * std::sqrt(2.0f) * cs * cs; }
+};
+
+struct BGKCollision {
+    template <int L>
+    static inline void Relax(float* const* f, size_t base, const float* rho, const float* u, const float* v,
+                             const CollisionRates<L>& rates) {
+        for (int k = 0; k < Q; k++) {
+            float* fk = f[k] + base;
+            for (int l = 0; l < L; l++) {
+                float usq = u[l]*u[l] + v[l]*v[l];
+                float eu = ex[k]*u[l] + ey[k]*v[l];
+                float feq = w[k] * rho[l] * (1.0f + 3.0f*eu + 4.5f*eu*eu - 1.5f*usq);
+                fk[l] -= (fk[l] - feq) * rates.omega[l]; // Low tau = fast relaxation = low viscosity
+            }
+        }
+    }
+};
+
+struct TRTCollision {
+    template <int L>
+    static inline void Relax(float* const* f, size_t base, const float* rho, const float* u, const float* v,
+                             const CollisionRates<L>& rates) {
+        float* f0 = f[0] + base;
+        for (int l = 0; l < L; l++) {
+            float usq = u[l]*u[l] + v[l]*v[l];
+            f0[l] -= (f0[l] - w[0] * rho[l] * (1.0f - 1.5f*usq)) * rates.omega[l];
+        }
+        // One direction of each opposite pair; the partner gets the odd part negated
+        const int pair[4] = {1, 2, 5, 6};
+        for (int p = 0; p < 4; p++) {
+            int k = pair[p];
+            float* fa = f[k] + base;
+            float* fb = f[opp[k]] + base;
+            for (int l = 0; l < L; l++) {
+                float usq = u[l]*u[l] + v[l]*v[l];
+                float eu = ex[k]*u[l] + ey[k]*v[l];
+                float even = 0.5f * (fa[l] + fb[l]) - w[k] * rho[l] * (1.0f + 4.5f*eu*eu - 1.5f*usq);
+                float odd = 0.5f * (fa[l] - fb[l]) - w[k] * rho[l] * 3.0f * eu;
+                float d_even = even * rates.omega[l];
+                float d_odd = odd * rates.omega_odd[l];
+                fa[l] -= d_even + d_odd;
+                fb[l] -= d_even - d_odd;
+            }
+        }
+    }
+};
+
+struct MRTCollision {
+    template <int L>
+    static inline void Relax(float* const* f, size_t base, const float* rho, const float* u, const float* v,
+                             const CollisionRates<L>& rates) {
+        const float s_e = 1.64f;   // Energy (bulk viscosity)
+        const float s_eps = 1.54f; // Energy square
+        const float s_q = 1.9f;    // Heat flux
+        float *f0 = f[0] + base, *f1 = f[1] + base, *f2 = f[2] + base, *f3 = f[3] + base, *f4 = f[4] + base;
+        float *f5 = f[5] + base, *f6 = f[6] + base, *f7 = f[7] + base, *f8 = f[8] + base;
+        for (int l = 0; l < L; l++) {
+            float r = rho[l];
+            float usq = u[l]*u[l] + v[l]*v[l];
+            float axis = f1[l] + f2[l] + f3[l] + f4[l];
+            float diag = f5[l] + f6[l] + f7[l] + f8[l];
+
+            // Non-equilibrium part of the non-conserved moments, times their rates
+            float de = (-4.0f*f0[l] - axis + 2.0f*diag - r * (-2.0f + 3.0f*usq)) * s_e;
+            float deps = (4.0f*f0[l] - 2.0f*axis + diag - r * (1.0f - 3.0f*usq)) * s_eps;
+            float dqx = (-2.0f*f1[l] + 2.0f*f3[l] + f5[l] - f6[l] - f7[l] + f8[l] + r * u[l]) * s_q;
+            float dqy = (-2.0f*f2[l] + 2.0f*f4[l] + f5[l] + f6[l] - f7[l] - f8[l] + r * v[l]) * s_q;
+            float dpxx = (f1[l] - f2[l] + f3[l] - f4[l] - r * (u[l]*u[l] - v[l]*v[l])) * rates.omega[l];
+            float dpxy = (f5[l] - f6[l] + f7[l] - f8[l] - r * u[l]*v[l]) * rates.omega[l];
+
+            // Back to populations: M^-1 = M^T diag(1 / |row|^2)
+            float a = de / 36.0f, b = deps / 36.0f;
+            float cx = dqx / 12.0f, cy = dqy / 12.0f;
+            float pxx = dpxx / 4.0f, pxy = dpxy / 4.0f;
+            float axis_common = -a - 2.0f*b;
+            float diag_common = 2.0f*a + b;
+            f0[l] -= 4.0f * (b - a);
+            f1[l] -= axis_common - 2.0f*cx + pxx;
+            f2[l] -= axis_common - 2.0f*cy - pxx;
+            f3[l] -= axis_common + 2.0f*cx + pxx;
+            f4[l] -= axis_common + 2.0f*cy - pxx;
+            f5[l] -= diag_common + cx + cy + pxy;
+            f6[l] -= diag_common - cx + cy - pxy;
+            f7[l] -= diag_common - cx - cy + pxy;
+            f8[l] -= diag_common + cx - cy - pxy;
+        }
+    }
+};
+
+struct CentralMomentCollision {
+    template <int L>
+    static inline void Relax(float* const* f, size_t base, const float* rho, const float* u, const float* v,
+                             const CollisionRates<L>& rates) {
+        const float omega_bulk = 1.0f;
+        float *f0 = f[0] + base, *f1 = f[1] + base, *f2 = f[2] + base, *f3 = f[3] + base, *f4 = f[4] + base;
+        float *f5 = f[5] + base, *f6 = f[6] + base, *f7 = f[7] + base, *f8 = f[8] + base;
+        for (int l = 0; l < L; l++) {
+            float r = rho[l], ux = u[l], uy = v[l];
+            float diag = f5[l] + f6[l] + f7[l] + f8[l];
+
+            // Second-order central moments
+            float kxx = f1[l] + f3[l] + diag - r * ux*ux;
+            float kyy = f2[l] + f4[l] + diag - r * uy*uy;
+            float kxy = f5[l] - f6[l] + f7[l] - f8[l] - r * ux*uy;
+
+            // Trace towards 2 rho / 3, deviator and shear towards 0; third and fourth order at equilibrium
+            float trace = (kxx + kyy) * (1.0f - omega_bulk) + omega_bulk * r * (2.0f / 3.0f);
+            float dev = (kxx - kyy) * (1.0f - rates.omega[l]);
+            kxy *= 1.0f - rates.omega[l];
+            kxx = 0.5f * (trace + dev);
+            kyy = 0.5f * (trace - dev);
+
+            // Back to raw moments
+            float m20 = kxx + r * ux*ux;
+            float m02 = kyy + r * uy*uy;
+            float m11 = kxy + r * ux*uy;
+            float m21 = 2.0f*ux*kxy + uy*kxx + r * ux*ux*uy;
+            float m12 = 2.0f*uy*kxy + ux*kyy + r * ux*uy*uy;
+            float m22 = r / 9.0f + ux*ux*kyy + uy*uy*kxx + 4.0f*ux*uy*kxy + r * ux*ux*uy*uy;
+            float jx = r * ux, jy = r * uy;
+
+            // ... and to populations
+            f0[l] = r - m20 - m02 + m22;
+            f1[l] = 0.5f * ( jx + m20 - m12 - m22);
+            f2[l] = 0.5f * ( jy + m02 - m21 - m22);
+            f3[l] = 0.5f * (-jx + m20 + m12 - m22);
+            f4[l] = 0.5f * (-jy + m02 + m21 - m22);
+            f5[l] = 0.25f * ( m11 + m21 + m12 + m22);
+            f6[l] = 0.25f * (-m11 + m21 - m12 + m22);
+            f7[l] = 0.25f * ( m11 - m21 - m12 + m22);
+            f8[l] = 0.25f * (-m11 - m21 + m12 + m22);
+        }
+    }
+};
+
+template <class Operator>
+struct Smagorinsky {
+    template <int L>
+    static inline void Relax(float* const* f, size_t base, const float* rho, const float* u, const float* v,
+                             const CollisionRates<L>& rates) {
+        float *f1 = f[1] + base, *f2 = f[2] + base, *f3 = f[3] + base, *f4 = f[4] + base;
+        float *f5 = f[5] + base, *f6 = f[6] + base, *f7 = f[7] + base, *f8 = f[8] + base;
+        CollisionRates<L> local;
+        for (int l = 0; l < L; l++) {
+            float r = rho[l];
+            float diag = f5[l] + f6[l] + f7[l] + f8[l];
+            float pxx = f1[l] + f3[l] + diag - r * (1.0f/3.0f + u[l]*u[l]);
+            float pyy = f2[l] + f4[l] + diag - r * (1.0f/3.0f + v[l]*v[l]);
+            float pxy = f5[l] - f6[l] + f7[l] - f8[l] - r * u[l]*v[l];
+            float flux = std::sqrt(pxx*pxx + pyy*pyy + 2.0f*pxy*pxy);
+
+            // tau = tau0 + 3 nu_t with nu_t = Cs^2 |S| and |S| = 3 sqrt(2) |Pi_neq| / (2 rho tau)
+            float tau0 = rates.tau[l];
+            local.Set(l, 0.5f * (tau0 + std::sqrt(tau0*tau0 + rates.smagorinsky * flux / r)));
+            if (rates.eddy_viscosity) rates.eddy_viscosity[base + l] = (local.tau[l] - tau0) / 3.0f;
+        }
+        Operator::template Relax<L>(f, base, rho, u, v, local);
+    }
+};
+
+// Positivity limiter on one cell after relaxation. Returns the number of lanes limited.
+template <int L>
+inline int LimitPositivity(float* const* f, size_t base, const float* rho, const float* u, const float* v) {
+    int limited = 0;
+    for (int l = 0; l < L; l++) {
+        float lowest = f[0][base + l];
+        for (int k = 1; k < Q; k++) lowest = std::min(lowest, f[k][base + l]);
+        if (lowest >= 0.0f) continue;
+
+        float usq = u[l]*u[l] + v[l]*v[l];
+        float feq[Q];
+        float alpha = 1.0f;
+        for (int k = 0; k < Q; k++) {
+            float eu = ex[k]*u[l] + ey[k]*v[l];
+            feq[k] = w[k] * rho[l] * (1.0f + 3.0f*eu + 4.5f*eu*eu - 1.5f*usq);
+            float fk = f[k][base + l];
+            if (fk < 0.0f) alpha = std::min(alpha, std::max(feq[k], 0.0f) / (feq[k] - fk));
+        }
+        for (int k = 0; k < Q; k++) f[k][base + l] = feq[k] + alpha * (f[k][base + l] - feq[k]);
+        limited++;
+    }
+    return limited;
+}
+
+// Guo forcing on one cell after relaxation, for the force density (fx, fy) per
+// lane. u and v are the shifted velocities (momentum + F / 2) / rho.
+template <int L>
+inline void GuoForce(float* const* f, size_t base, const float* rho, const float* u, const float* v,
+                     const float* fx, const float* fy, const CollisionRates<L>& rates) {
+    alignas(64) float jx[L] = {};
+    alignas(64) float jy[L] = {};
+    for (int k = 1; k < Q; k++) {
+        const float* fk = f[k] + base;
+        for (int l = 0; l < L; l++) {
+            jx[l] += ex[k] * fk[l];
+            jy[l] += ey[k] * fk[l];
+        }
+    }
+    for (int l = 0; l < L; l++) {
+        // Momentum still missing after relaxation
+        jx[l] = rho[l]*u[l] + 0.5f*fx[l] - jx[l];
+        jy[l] = rho[l]*v[l] + 0.5f*fy[l] - jy[l];
+    }
+    for (int k = 0; k < Q; k++) {
+        float* fk = f[k] + base;
+        for (int l = 0; l < L; l++) {
+            float eu = ex[k]*u[l] + ey[k]*v[l];
+            float ef = ex[k]*fx[l] + ey[k]*fy[l];
+            float uf = u[l]*fx[l] + v[l]*fy[l];
+            float second = (1.0f - 0.5f*rates.omega[l]) * (9.0f*eu*ef - 3.0f*uf);
+            fk[l] += w[k] * (3.0f*(ex[k]*jx[l] + ey[k]*jy[l]) + second);
+        }
+    }
+}
+
+// Calls visit(Operator{}) with the selected operator, wrapped in the subgrid
+// model when it is enabled. One switch per sweep, not per cell.
+template <class Visitor>
+inline void DispatchCollision(CollisionType type, bool subgrid, Visitor&& visit) {
+    switch (type) {
+    case CollisionType::TRT:
+        if (subgrid) visit(Smagorinsky<TRTCollision>{}); else visit(TRTCollision{});
+        break;
+    case CollisionType::MRT:
+        if (subgrid) visit(Smagorinsky<MRTCollision>{}); else visit(MRTCollision{});
+        break;
+    case CollisionType::CentralMoment:
+        if (subgrid) visit(Smagorinsky<CentralMomentCollision>{}); else visit(CentralMomentCollision{});
+        break;
+    default:
+        if (subgrid) visit(Smagorinsky<BGKCollision>{}); else visit(BGKCollision{});
+        break;
+    }
+}
+
+inline const char* CollisionTypeName(CollisionType type) {
+    switch (type) {
+    case CollisionType::TRT: return "trt";
+    case CollisionType::MRT: return "mrt";
+    case CollisionType::CentralMoment: return "central";
+    default: return "bgk";
+    }
+}
+
+inline bool ParseCollisionType(const std::string& name, CollisionType& type) {
+    if (name == "bgk") type = CollisionType::BGK;
+    else if (name == "trt") type = CollisionType::TRT;
+    else if (name == "mrt") type = CollisionType::MRT;
+    else if (name == "central") type = CollisionType::CentralMoment;
+    else return false;
+    return true;
+}
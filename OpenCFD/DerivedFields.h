@@ -0,0 +1,182 @@
+﻿/**
+ * @file DerivedFields.h
+ * @brief Lazily computed fields derived from the macroscopic rho/ux/uy
+ *
+ * A field is computed the first time a consumer (renderer, writer, ...) asks for
+ * it in a given time step and cached until the step changes, so several consumers
+ * in one step share one evaluation. The velocity gradient tensor is an internal
+ * cached intermediate shared by vorticity, Q-criterion and strain rate. The eddy
+ * viscosity is not derived here: the collision kernel stores the value it applied.
+ */
+
+#pragma once
+
+#include "Lattice.h"
+#include <cmath>
+#include <string>
+#include <vector>
+
+enum class DerivedField {
+    Speed,          // |u|
+    Vorticity,      // dv/dx - du/dy
+    Pressure,       // rho / 3
+    QCriterion,     // (|Omega|^2 - |S|^2) / 2
+    StrainRate,     // sqrt(2 S:S)
+    EddyViscosity,  // Smagorinsky nu_t applied by the collision kernel (0 without the model)
+    Count
+};
+
+inline const char* DerivedFieldName(DerivedField field) {
+    switch (field) {
+        case DerivedField::Speed: return "speed";
+        case DerivedField::Vorticity: return "vorticity";
+        case DerivedField::Pressure: return "pressure";
+        case DerivedField::QCriterion: return "qcriterion";
+        case DerivedField::StrainRate: return "strainrate";
+        case DerivedField::EddyViscosity: return "eddyviscosity";
+        default: return "unknown";
+    }
+}
+
+// Returns false if the name does not match any field
+inline bool ParseDerivedField(const std::string& name, DerivedField& field) {
+    for (int i = 0; i < (int)DerivedField::Count; i++) {
+        if (name == DerivedFieldName((DerivedField)i)) {
+            field = (DerivedField)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+class DerivedFields {
+private:
+    static const int Count = (int)DerivedField::Count;
+
+    const std::vector<float>* rho = nullptr;
+    const std::vector<float>* ux = nullptr;
+    const std::vector<float>* uy = nullptr;
+    const std::vector<bool>* obstacle = nullptr;
+
+    std::vector<float> fields[Count];
+    int field_step[Count];
+    std::vector<float> dudx, dudy, dvdx, dvdy;
+    int gradient_step = -1;
+    const std::vector<float>* eddy_viscosity = nullptr; // Written by the Smagorinsky kernel
+
+    // Central differences, periodic in y and one-sided at the inlet/outlet columns.
+    // Interior columns of each row are a contiguous, branch-free loop.
+    void ComputeGradient() {
+        const float* u = ux->data();
+        const float* v = uy->data();
+        size_t N = (size_t)NX * NY;
+        dudx.resize(N);
+        dudy.resize(N);
+        dvdx.resize(N);
+        dvdy.resize(N);
+
+        for (int y = 0; y < NY; y++) {
+            int row = y * NX;
+            int up = ((y + 1) % NY) * NX;
+            int down = ((y + NY - 1) % NY) * NX;
+
+            for (int x = 1; x < NX - 1; x++) {
+                dudx[row + x] = 0.5f * (u[row + x + 1] - u[row + x - 1]);
+                dvdx[row + x] = 0.5f * (v[row + x + 1] - v[row + x - 1]);
+            }
+            dudx[row] = u[row + 1] - u[row];
+            dvdx[row] = v[row + 1] - v[row];
+            dudx[row + NX - 1] = u[row + NX - 1] - u[row + NX - 2];
+            dvdx[row + NX - 1] = v[row + NX - 1] - v[row + NX - 2];
+
+            for (int x = 0; x < NX; x++) {
+                dudy[row + x] = 0.5f * (u[up + x] - u[down + x]);
+                dvdy[row + x] = 0.5f * (v[up + x] - v[down + x]);
+            }
+        }
+    }
+
+    void Compute(DerivedField field, std::vector<float>& out) {
+        size_t N = (size_t)NX * NY;
+        out.resize(N);
+        const float* u = ux->data();
+        const float* v = uy->data();
+
+        switch (field) {
+            case DerivedField::Speed:
+                for (size_t i = 0; i < N; i++) out[i] = std::sqrt(u[i]*u[i] + v[i]*v[i]);
+                break;
+            case DerivedField::Pressure:
+                for (size_t i = 0; i < N; i++) out[i] = (*rho)[i] / 3.0f;
+                break;
+            case DerivedField::Vorticity:
+                for (size_t i = 0; i < N; i++) out[i] = dvdx[i] - dudy[i];
+                break;
+            case DerivedField::QCriterion:
+                for (size_t i = 0; i < N; i++) {
+                    out[i] = -0.5f * (dudx[i]*dudx[i] + dvdy[i]*dvdy[i]) - dudy[i]*dvdx[i];
+                }
+                break;
+            case DerivedField::StrainRate:
+                for (size_t i = 0; i < N; i++) {
+                    float shear = dudy[i] + dvdx[i];
+                    out[i] = std::sqrt(2.0f * (dudx[i]*dudx[i] + dvdy[i]*dvdy[i]) + shear*shear);
+                }
+                break;
+            case DerivedField::EddyViscosity:
+                if (eddy_viscosity) out.assign(eddy_viscosity->begin(), eddy_viscosity->end());
+                else out.assign(N, 0.0f);
+                break;
+            default:
+                break;
+        }
+
+        // Nothing is defined inside obstacles
+        for (size_t i = 0; i < N; i++) {
+            if ((*obstacle)[i]) out[i] = 0.0f;
+        }
+    }
+
+public:
+    DerivedFields() {
+        for (int i = 0; i < Count; i++) field_step[i] = -1;
+    }
+
+    void Bind(const std::vector<float>& density, const std::vector<float>& vel_x,
+              const std::vector<float>& vel_y, const std::vector<bool>& mask) {
+        rho = &density;
+        ux = &vel_x;
+        uy = &vel_y;
+        obstacle = &mask;
+        Invalidate();
+    }
+
+    // Per-cell nu_t from the collision kernel, or nullptr without the subgrid model
+    void SetEddyViscosity(const std::vector<float>* applied) {
+        eddy_viscosity = applied;
+        field_step[(int)DerivedField::EddyViscosity] = -1;
+    }
+
+    // Drops every cached field (e.g. after the geometry changed mid-step)
+    void Invalidate() {
+        for (int i = 0; i < Count; i++) field_step[i] = -1;
+        gradient_step = -1;
+    }
+
+    // Returns the field for `step`, computing it only on the first request of that step
+    const std::vector<float>& Get(DerivedField field, int step) {
+        int f = (int)field;
+        if (field_step[f] == step) return fields[f];
+
+        bool needs_gradient = field == DerivedField::Vorticity || field == DerivedField::QCriterion ||
+                              field == DerivedField::StrainRate;
+        if (needs_gradient && gradient_step != step) {
+            ComputeGradient();
+            gradient_step = step;
+        }
+
+        Compute(field, fields[f]);
+        field_step[f] = step;
+        return fields[f];
+    }
+};
@@ -0,0 +1,445 @@
+﻿/**
+ * @file EnsembleLBM.h
+ * @brief Ensemble solver running L independent cases interleaved per cell
+ *
+ * Every case shares the geometry and the control flow of FastAirLBM, so the
+ * populations are stored as f[k][cell * L + lane] and each lane carries its own
+ * tau and inlet velocity. The inner loops run over the L lanes of one cell and
+ * compile to packed SIMD arithmetic; streaming, bounce-back and the obstacle
+ * tests are done once per cell for all lanes.
+ */
+
+#pragma once
+
+#include "Lattice.h"
+#include "Geometry.h"
+#include "Boundaries.h"
+#include "Collision.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <utility>
+#include <vector>
+
+template <int L>
+class EnsembleLBM {
+public:
+    // A lane's results saved at the step it stopped, since the batch keeps stepping it
+    struct LaneResult {
+        int steps = -1;             // Steps taken when the lane converged or diverged, -1 while running
+        float residual = 0.0f;
+        float max_speed = 0.0f;
+        std::vector<float> cd, cl;  // Per obstacle
+    };
+
+private:
+    std::vector<float> f[Q], f_temp[Q]; // Distribution functions [Q][N * L]
+    std::vector<float> rho, ux, uy;     // Macroscopic fields [N * L]
+    std::vector<float> ux_prev, uy_prev;
+    std::shared_ptr<const Geometry> geometry;
+    std::vector<float> force_x, force_y; // Momentum-exchange force [obstacle * L + lane]
+
+    CollisionRates<L> rates;      // Relaxation rates per lane (from each lane's tau)
+    alignas(64) float u_in[L];
+    SimParams params[L];
+    CollisionType collision;             // Operator, subgrid model, limiter and edges are shared by all lanes (lane 0's)
+    bool limiter;
+    InletType inlet;
+    OutletType outlet;
+    bool channel;                        // Periodic in x between walls: no inlet or outlet
+    bool forced;
+    alignas(64) float drive_x[L];        // Uniform body force density per lane (Guo forcing)
+    alignas(64) float drive_y[L];
+    std::vector<float> outlet_prev;      // Convective outlet: last unknowns [y][3][L]
+    std::vector<float> sponge_rate;      // Sponge blend rate per column (last columns)
+    std::vector<float> sponge_target;    // Far-field equilibrium [y][Q][L]
+
+    int time_step;
+    int check_interval;
+    float tolerance;
+    float residual[L];
+    int converged_step[L];   // Step at which each lane converged, -1 while running
+    int diverged_step[L];    // Step at which each lane hit NaN/Inf/non-positive density, -1 while healthy
+    int bad_cell[L];         // First bad cell of each diverged lane
+    alignas(64) int healthy[L];
+    LaneResult result[L];
+
+    static float InletProfile(int y, float min_profile) {
+        float y_center = (float)y - NY/2.0f;
+        float profile = 1.0f - 2.0f * (y_center/(NY/2.0f)) * (y_center/(NY/2.0f));
+        return std::max(min_profile, profile);
+    }
+
+    // Poiseuille profile between the halfway walls of a channel
+    static float ChannelProfile(int y) {
+        float s = y - 0.5f, H = NY - 2.0f;
+        return 4.0f * s * (H - s) / (H * H);
+    }
+
+    void Equilibrium(int id, const float* density, const float* u, const float* v) {
+        for (int k = 0; k < Q; k++) {
+            float* fk = &f[k][(size_t)id * L];
+            for (int l = 0; l < L; l++) {
+                float usq = u[l]*u[l] + v[l]*v[l];
+                float eu = ex[k]*u[l] + ey[k]*v[l];
+                fk[l] = w[k] * density[l] * (1.0f + 3.0f*eu + 4.5f*eu*eu - 1.5f*usq);
+            }
+        }
+    }
+
+    // Moments and relaxation fused into one pass (same arithmetic as
+    // FastAirLBM::ComputeMacroscopic followed by FastAirLBM::Collision)
+    void MacroscopicCollision() {
+        DispatchCollision(collision, rates.smagorinsky > 0.0f, [this](auto op) { MacroscopicCollide<decltype(op)>(); });
+    }
+
+    template <class Operator>
+    void MacroscopicCollide() {
+        const std::vector<bool>& obstacle = geometry->obstacle;
+        bool check = check_interval > 0 && time_step > 0 && time_step % check_interval == 0;
+        double diff_sum[L] = {};
+        double norm_sum[L] = {};
+        float* fp[Q];
+        for (int k = 0; k < Q; k++) fp[k] = f[k].data();
+
+        for (int id = 0; id < NX * NY; id++) {
+            size_t base = (size_t)id * L;
+            float* r = &rho[base];
+            float* u = &ux[base];
+            float* v = &uy[base];
+
+            if (obstacle[id]) {
+                for (int l = 0; l < L; l++) {
+                    r[l] = 1.0f;
+                    u[l] = 0.0f;
+                    v[l] = 0.0f;
+                }
+                continue;
+            }
+
+            alignas(64) float density[L] = {};
+            alignas(64) float vel_x[L] = {};
+            alignas(64) float vel_y[L] = {};
+            for (int k = 0; k < Q; k++) {
+                const float* fk = &f[k][base];
+                for (int l = 0; l < L; l++) {
+                    density[l] += fk[l];
+                    vel_x[l] += ex[k] * fk[l];
+                    vel_y[l] += ey[k] * fk[l];
+                }
+            }
+            if (forced) {
+                for (int l = 0; l < L; l++) {
+                    vel_x[l] += 0.5f * drive_x[l];
+                    vel_y[l] += 0.5f * drive_y[l];
+                }
+            }
+            // NaN, Inf or a non-positive density in a lane that was still healthy (cold path)
+            int bad = 0;
+            for (int l = 0; l < L; l++) {
+                bad |= healthy[l] & !(density[l] > 0.0f && density[l] <= std::numeric_limits<float>::max());
+            }
+            if (bad) MarkDiverged(id, density);
+
+            for (int l = 0; l < L; l++) {
+                r[l] = density[l];
+                u[l] = vel_x[l] / density[l];
+                v[l] = vel_y[l] / density[l];
+            }
+
+            if (check) {
+                float* up = &ux_prev[base];
+                float* vp = &uy_prev[base];
+                for (int l = 0; l < L; l++) {
+                    float du = u[l] - up[l];
+                    float dv = v[l] - vp[l];
+                    diff_sum[l] += du*du + dv*dv;
+                    norm_sum[l] += u[l]*u[l] + v[l]*v[l];
+                    up[l] = u[l];
+                    vp[l] = v[l];
+                }
+            }
+
+            Operator::template Relax<L>(fp, base, r, u, v, rates);
+            if (forced) GuoForce<L>(fp, base, r, u, v, drive_x, drive_y, rates);
+            if (limiter) LimitPositivity<L>(fp, base, r, u, v);
+        }
+
+        if (check) {
+            for (int l = 0; l < L; l++) {
+                residual[l] = (float)(std::sqrt(diff_sum[l] / (norm_sum[l] + 1e-30)) / check_interval);
+                if (converged_step[l] < 0 && residual[l] < tolerance) converged_step[l] = time_step;
+            }
+        }
+    }
+
+    void SaveResult(int l) {
+        LaneResult& r = result[l];
+        r.steps = time_step;
+        r.residual = residual[l];
+        r.max_speed = GetMaxSpeed(l);
+        r.cd.resize(geometry->num_obstacles);
+        r.cl.resize(geometry->num_obstacles);
+        for (int o = 0; o < geometry->num_obstacles; o++) {
+            r.cd[o] = GetDragCoefficient(l, o);
+            r.cl[o] = GetLiftCoefficient(l, o);
+        }
+    }
+
+    void MarkDiverged(int id, const float* density) {
+        for (int l = 0; l < L; l++) {
+            if (healthy[l] && !(density[l] > 0.0f && density[l] <= std::numeric_limits<float>::max())) {
+                healthy[l] = 0;
+                diverged_step[l] = time_step;
+                bad_cell[l] = id;
+            }
+        }
+    }
+
+    void Streaming() {
+        for (int y = 0; y < NY; y++) {
+            for (int x = 0; x < NX; x++) {
+                size_t base = (size_t)idx(x, y) * L;
+
+                for (int k = 0; k < Q; k++) {
+                    int x_new = x + ex[k];
+                    int y_new = y + ey[k];
+
+                    // Periodic boundaries top/bottom
+                    if (y_new < 0) y_new = NY - 1;
+                    if (y_new >= NY) y_new = 0;
+
+                    // Handle left/right boundaries (periodic in a channel)
+                    x_new = Geometry::Column(x_new, channel);
+                    if (x_new >= 0) {
+                        std::copy_n(&f[k][base], L, &f_temp[k][(size_t)idx(x_new, y_new) * L]);
+                    }
+                }
+            }
+        }
+
+        // Interpolated (Bouzidi) bounce-back over the shared boundary links,
+        // with the momentum exchange summed per obstacle and lane
+        std::fill(force_x.begin(), force_x.end(), 0.0f);
+        std::fill(force_y.begin(), force_y.end(), 0.0f);
+        for (const BoundaryLink& link : geometry->links) {
+            int ko = opp[link.k];
+            const float* fk = &f[link.k][(size_t)link.id * L];
+            const float* fo = &f[ko][(size_t)link.id * L];
+            const float* fu = &f[link.k][(size_t)(link.upstream < 0 ? link.id : link.upstream) * L];
+            float* back = &f_temp[ko][(size_t)link.id * L];
+            float* fx = &force_x[(size_t)link.obstacle * L];
+            float* fy = &force_y[(size_t)link.obstacle * L];
+            for (int l = 0; l < L; l++) {
+                back[l] = link.w_near * fk[l] + link.w_up * fu[l] + link.w_opp * fo[l] + link.wall;
+                fx[l] += (fk[l] + back[l]) * ex[link.k];
+                fy[l] += (fk[l] + back[l]) * ey[link.k];
+            }
+        }
+
+        for (int k = 0; k < Q; k++) std::swap(f[k], f_temp[k]);
+    }
+
+    void BoundaryConditions() {
+        if (channel) return;
+        float* fp[Q];
+        for (int k = 0; k < Q; k++) fp[k] = f[k].data();
+
+        // Inlet (left side): per-lane inlet speed, imposed by equilibrium or Zou-He
+        for (int y = 0; y < NY; y++) {
+            int id = idx(0, y);
+            size_t base = (size_t)id * L;
+            float profile = InletProfile(y, 0.3f);
+            for (int l = 0; l < L; l++) {
+                rho[base + l] = 1.0f;
+                ux[base + l] = u_in[l] * profile;
+                uy[base + l] = 0.0f;
+            }
+            if (inlet == InletType::ZouHe) ZouHeVelocityInlet<L>(fp, base, &ux[base]);
+            else Equilibrium(id, &rho[base], &ux[base], &uy[base]);
+        }
+
+        // Outlet (right side)
+        for (int y = 0; y < NY; y++) {
+            size_t out = (size_t)idx(NX-1, y) * L;
+            size_t in = (size_t)idx(NX-2, y) * L;
+            if (outlet == OutletType::Pressure) ZouHePressureOutlet<L>(fp, out, 1.0f);
+            else if (outlet == OutletType::Convective) ConvectiveOutlet<L>(fp, out, in, &ux[in], &outlet_prev[(size_t)y * 3 * L]);
+            else CopyOutlet<L>(fp, out, in);
+        }
+    }
+
+    // Damps the sponge columns towards the far field (post-collision)
+    void Sponge() {
+        if (sponge_rate.empty()) return;
+        const std::vector<bool>& obstacle = geometry->obstacle;
+        float* fp[Q];
+        for (int k = 0; k < Q; k++) fp[k] = f[k].data();
+        int x0 = NX - (int)sponge_rate.size();
+        for (int y = 0; y < NY; y++) {
+            for (int x = x0; x < NX; x++) {
+                int id = idx(x, y);
+                if (obstacle[id]) continue;
+                SpongeRelax<L>(fp, (size_t)id * L, sponge_rate[x - x0], &sponge_target[(size_t)y * Q * L]);
+            }
+        }
+    }
+
+public:
+    static constexpr int Lanes = L;
+
+    // Cases beyond the first L are ignored; missing lanes repeat the last case
+    EnsembleLBM(const std::vector<SimParams>& cases, std::shared_ptr<const Geometry> geom)
+        : geometry(std::move(geom)), time_step(0), check_interval(100), tolerance(1e-6f) {
+        channel = cases.front().channel;
+        if (channel && !geometry->periodic_x) geometry = Geometry::Channel(*geometry);
+        size_t N = (size_t)NX * NY * L;
+        for (int k = 0; k < Q; k++) {
+            f[k].resize(N);
+            f_temp[k].resize(N);
+        }
+        rho.resize(N);
+        ux.resize(N);
+        uy.resize(N);
+        ux_prev.resize(N);
+        uy_prev.resize(N);
+        force_x.assign((size_t)geometry->num_obstacles * L, 0.0f);
+        force_y.assign((size_t)geometry->num_obstacles * L, 0.0f);
+
+        forced = false;
+        for (int l = 0; l < L; l++) {
+            params[l] = cases[std::min((size_t)l, cases.size() - 1)];
+            rates.Set(l, params[l].Tau());
+            u_in[l] = params[l].u_in;
+            params[l].BodyForce(drive_x[l], drive_y[l]);
+            if (drive_x[l] != 0.0f || drive_y[l] != 0.0f) forced = true;
+            residual[l] = 1.0f;
+            converged_step[l] = -1;
+            diverged_step[l] = -1;
+            bad_cell[l] = -1;
+            healthy[l] = 1;
+        }
+        collision = params[0].collision;
+        limiter = params[0].limiter;
+        rates.SetSmagorinsky(params[0].smagorinsky);
+        inlet = params[0].inlet;
+        outlet = params[0].outlet;
+        outlet_prev.resize((size_t)NY * 3 * L);
+
+        if (!channel) sponge_rate = SpongeRates(std::min(params[0].sponge, NX - 2), params[0].sponge_strength, params[0].sponge_profile);
+        sponge_target.resize((size_t)NY * Q * L);
+        for (int y = 0; y < NY; y++) {
+            float profile = InletProfile(y, 0.3f);
+            for (int k = 0; k < Q; k++) {
+                for (int l = 0; l < L; l++) {
+                    float eu = ex[k] * u_in[l] * profile;
+                    float usq = u_in[l] * profile * u_in[l] * profile;
+                    sponge_target[((size_t)y * Q + k) * L + l] = w[k] * (1.0f + 3.0f*eu + 4.5f*eu*eu - 1.5f*usq);
+                }
+            }
+        }
+    }
+
+    void Initialize() {
+        const std::vector<bool>& obstacle = geometry->obstacle;
+        float cx = geometry->cx;
+        float R = geometry->radius;
+
+        for (int y = 0; y < NY; y++) {
+            for (int x = 0; x < NX; x++) {
+                int id = idx(x, y);
+                size_t base = (size_t)id * L;
+                float profile = channel ? ChannelProfile(y) : InletProfile(y, 0.2f);
+
+                for (int l = 0; l < L; l++) {
+                    rho[base + l] = 1.0f;
+                    ux[base + l] = 0.0f;
+                    uy[base + l] = 0.0f;
+                    if (obstacle[id]) continue;
+
+                    ux[base + l] = u_in[l] * profile;
+                    if (x > cx + R + 2 && x < cx + R + 20) {
+                        uy[base + l] = 0.1f * u_in[l] * std::sin(6.28f * y / (NY/4));
+                    }
+                }
+                Equilibrium(id, &rho[base], &ux[base], &uy[base]);
+            }
+        }
+
+        ux_prev = ux;
+        uy_prev = uy;
+        for (int y = 0; y < NY; y++) {
+            for (int j = 0; j < 3; j++) {
+                std::copy_n(&f[OutletUnknown[j]][(size_t)idx(NX-1, y) * L], L, &outlet_prev[((size_t)y * 3 + j) * L]);
+            }
+        }
+    }
+
+    void Step() {
+        MacroscopicCollision();
+        Sponge();
+        Streaming();
+        BoundaryConditions();
+        time_step++;
+        for (int l = 0; l < L; l++) {
+            if (result[l].steps < 0 && (converged_step[l] >= 0 || diverged_step[l] >= 0)) SaveResult(l);
+        }
+    }
+
+    // Saves the lanes still running, e.g. when the batch hits its step limit
+    void SaveRunning() {
+        for (int l = 0; l < L; l++) {
+            if (result[l].steps < 0) SaveResult(l);
+        }
+    }
+
+    // True once every lane has converged or diverged
+    bool AllConverged() const {
+        for (int l = 0; l < L; l++) {
+            if (converged_step[l] < 0 && diverged_step[l] < 0) return false;
+        }
+        return true;
+    }
+
+    void SetConvergence(int interval, float tol) {
+        check_interval = interval;
+        tolerance = tol;
+    }
+
+    int GetTimeStep() const { return time_step; }
+    const SimParams& GetParams(int lane) const { return params[lane]; }
+    float GetTau(int lane) const { return 1.0f / rates.omega[lane]; }
+    float GetReynolds(int lane) const {
+        return params[lane].u_in * (2.0f * params[lane].radius) / ((GetTau(lane) - 0.5f) / 3.0f);
+    }
+    float GetResidual(int lane) const { return residual[lane]; }
+    int GetConvergedStep(int lane) const { return converged_step[lane]; }
+    int GetDivergedStep(int lane) const { return diverged_step[lane]; }
+    int GetBadCell(int lane) const { return bad_cell[lane]; }
+    const LaneResult& GetResult(int lane) const { return result[lane]; }
+
+    int GetObstacleCount() const { return geometry->num_obstacles; }
+    float GetDragCoefficient(int lane, int obstacle) const {
+        const SimParams& p = params[lane];
+        return force_x[(size_t)obstacle * L + lane] / (0.5f * p.u_in * p.u_in * 2.0f * p.radius);
+    }
+    float GetLiftCoefficient(int lane, int obstacle) const {
+        const SimParams& p = params[lane];
+        return force_y[(size_t)obstacle * L + lane] / (0.5f * p.u_in * p.u_in * 2.0f * p.radius);
+    }
+
+    float GetUx(int lane, int x, int y) const { return ux[(size_t)idx(x, y) * L + lane]; }
+    float GetUy(int lane, int x, int y) const { return uy[(size_t)idx(x, y) * L + lane]; }
+
+    float GetMaxSpeed(int lane) const {
+        const std::vector<bool>& obstacle = geometry->obstacle;
+        float max_speed = 0.0f;
+        for (int id = 0; id < NX * NY; id++) {
+            if (obstacle[id]) continue;
+            size_t i = (size_t)id * L + lane;
+            max_speed = std::max(max_speed, std::sqrt(ux[i]*ux[i] + uy[i]*uy[i]));
+        }
+        return max_speed;
+    }
+};
@@ -0,0 +1,633 @@
+﻿/**
+ * @file Geometry.h
+ * @brief Obstacle geometry shared between solvers
+ *
+ * Geometries come from the built-in cylinder, from a bitmap mask (PGM here, PNG via
+ * raylib in the viewer) or from polygon outlines (coordinate lists such as airfoil
+ * .dat files, or SVG-style path data). Masks and polygons are rasterized row by row
+ * on the thread pool with 4x4 sub-cell coverage; a cell is solid when at least half
+ * of it is covered.
+ *
+ * Every fluid->solid link carries its wall distance q, taken from the analytic circle
+ * or the source polygons (0.5 for masks), and the interpolation weights of the linear
+ * Bouzidi bounce-back derived from it.
+ *
+ * Channel() turns any geometry into a periodic channel: solid top and bottom rows,
+ * and links that wrap around the left/right edges like the streaming does there.
+ */
+
+#pragma once
+
+#include "Lattice.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Closed outline in cell coordinates (the last point connects back to the first)
+struct Polygon {
+    std::vector<float> x, y;
+};
+
+// Fluid cell `id` whose population k streams into a solid cell of `obstacle`.
+// The wall sits at fraction q of the link. The reflected population is
+//   f_opp(id) = w_near f_k(id) + w_up f_k(upstream) + w_opp f_opp(id)
+// using post-collision values (linear Bouzidi); q = 0.5 is plain halfway bounce-back.
+struct BoundaryLink {
+    int id;
+    int k;
+    int obstacle;
+    float q = 0.5f;
+    int upstream = -1;      // id - e_k, a fluid cell; only read when w_up != 0
+    float w_near = 1.0f;
+    float w_up = 0.0f;
+    float w_opp = 0.0f;
+    float wall = 0.0f;      // Moving-wall momentum term, added to f_opp (zero for static walls)
+};
+
+// Obstacle mask plus the cylinder it was built from, with the boundary links
+// precomputed for bounce-back and force evaluation.
+// Immutable once built, so many solvers can share one instance across threads.
+// Moving bodies (MovingBody.h) own a private copy that they update in place.
+struct Geometry {
+    std::vector<bool> obstacle;
+    std::vector<int> label;             // Obstacle index per solid cell, -1 for fluid
+    std::vector<BoundaryLink> links;
+    int num_obstacles = 0;
+    std::vector<float> coverage;        // Solid fraction per cell (imported geometries only)
+    std::vector<Polygon> polygons;      // Source outlines, kept for exact wall distances
+    float cx, cy, radius;               // Reference centre and half frontal height
+    bool periodic_x = false;            // Channel: links wrap around the left/right edges
+    
+    static const int SubSamples = 4;    // Per axis, for sub-cell coverage
+    
+    // Neighbour column, wrapped in a channel and -1 past the inlet/outlet otherwise
+    static int Column(int x, bool periodic) {
+        if (periodic) return (x + NX) % NX;
+        return x >= 0 && x < NX ? x : -1;
+    }
+    
+    // Labels connected solid regions (periodic in y like the streaming) and
+    // collects every fluid->solid link in one pass over the grid
+    void BuildLinks() {
+        label.assign(NX * NY, -1);
+        links.clear();
+        num_obstacles = 0;
+        
+        std::vector<int> stack;
+        for (int start = 0; start < NX * NY; start++) {
+            if (!obstacle[start] || label[start] >= 0) continue;
+            
+            label[start] = num_obstacles;
+            stack.push_back(start);
+            while (!stack.empty()) {
+                int id = stack.back();
+                stack.pop_back();
+                int x = id % NX;
+                int y = id / NX;
+                for (int k = 1; k <= 4; k++) {
+                    int xn = Column(x + ex[k], periodic_x);
+                    int yn = (y + ey[k] + NY) % NY;
+                    if (xn < 0) continue;
+                    int n = idx(xn, yn);
+                    if (obstacle[n] && label[n] < 0) {
+                        label[n] = num_obstacles;
+                        stack.push_back(n);
+                    }
+                }
+            }
+            num_obstacles++;
+        }
+        
+        for (int y = 0; y < NY; y++) {
+            for (int x = 0; x < NX; x++) {
+                int id = idx(x, y);
+                if (obstacle[id]) continue;
+                for (int k = 1; k < Q; k++) {
+                    int xn = Column(x + ex[k], periodic_x);
+                    int yn = (y + ey[k] + NY) % NY;
+                    if (xn < 0) continue;
+                    int n = idx(xn, yn);
+                    if (obstacle[n]) links.push_back({id, k, label[n]});
+                }
+            }
+        }
+    }
+    
+    // Stores q and the Bouzidi weights for one link. Below q = 0.5 the scheme needs
+    // the upstream fluid cell; where that is missing (thin solids, domain edge) the
+    // link falls back to halfway bounce-back.
+    static void SetWallDistance(BoundaryLink& link, float q, const std::vector<bool>& solid, bool periodic = false) {
+        int x = link.id % NX, y = link.id / NX;
+        int xu = Column(x - ex[link.k], periodic);
+        int yu = (y - ey[link.k] + NY) % NY;
+        link.upstream = (xu >= 0 && !solid[idx(xu, yu)]) ? idx(xu, yu) : -1;
+        SetLinkWeights(link, q);
+    }
+    
+    // Bouzidi weights for wall distance q, once link.upstream is known
+    static void SetLinkWeights(BoundaryLink& link, float q) {
+        q = std::min(1.0f, std::max(1e-3f, q));
+        if (q < 0.5f && link.upstream < 0) q = 0.5f;
+        
+        link.q = q;
+        if (q < 0.5f) {
+            link.w_near = 2.0f * q;
+            link.w_up = 1.0f - 2.0f * q;
+            link.w_opp = 0.0f;
+        } else {
+            link.w_near = 0.5f / q;
+            link.w_up = 0.0f;
+            link.w_opp = (2.0f * q - 1.0f) / (2.0f * q);
+        }
+    }
+    
+    // Fraction of the link p -> p + (dx, dy) before it enters the circle of radius r
+    // centred at the origin (first root of |p + t e| = r), or -1 if it stays outside
+    static float CircleLinkDistance(float px, float py, float dx, float dy, float r) {
+        float a = dx * dx + dy * dy;
+        float b = px * dx + py * dy;
+        float c = px * px + py * py - r * r;
+        float disc = b * b - a * c;
+        if (disc < 0.0f) return -1.0f;
+        float t = (-b - std::sqrt(disc)) / a;
+        return (t > 0.0f && t <= 1.0f) ? t : -1.0f;
+    }
+    
+    // Fraction of the link to the nearest outline edge it crosses, or -1
+    static float PolygonLinkDistance(const std::vector<Polygon>& outlines, float px, float py, float dx, float dy) {
+        float best = 2.0f;
+        for (const Polygon& poly : outlines) {
+            size_t n = poly.x.size();
+            for (size_t i = 0; i < n; i++) {
+                size_t j = (i + 1) % n;
+                float sx = poly.x[j] - poly.x[i], sy = poly.y[j] - poly.y[i];
+                float denom = dx * sy - dy * sx;
+                if (denom == 0.0f) continue;
+                float wx = poly.x[i] - px, wy = poly.y[i] - py;
+                float t = (wx * sy - wy * sx) / denom;  // Along the link
+                float u = (wx * dy - wy * dx) / denom;  // Along the edge
+                if (t > 0.0f && t <= 1.0f && u >= 0.0f && u <= 1.0f) best = std::min(best, t);
+            }
+        }
+        return best <= 1.0f ? best : -1.0f;
+    }
+    
+    // Exact distances to the circle. Links the rasterization disagrees with keep q = 0.5.
+    void SetCircleDistances(float ccx, float ccy, float r) {
+        for (BoundaryLink& link : links) {
+            float q = CircleLinkDistance(link.id % NX - ccx, link.id / NX - ccy,
+                                         (float)ex[link.k], (float)ey[link.k], r);
+            SetWallDistance(link, q > 0.0f ? q : 0.5f, obstacle, periodic_x);
+        }
+    }
+    
+    // Distances to the nearest polygon edge crossed by each link. Links whose
+    // segment misses the outline (coverage rounding near vertices) keep q = 0.5.
+    void SetPolygonDistances() {
+        for (BoundaryLink& link : links) {
+            float q = PolygonLinkDistance(polygons, (float)(link.id % NX), (float)(link.id / NX),
+                                          (float)ex[link.k], (float)ey[link.k]);
+            SetWallDistance(link, q > 0.0f ? q : 0.5f, obstacle, periodic_x);
+        }
+    }
+    
+    static std::shared_ptr<const Geometry> Cylinder(float radius) {
+        auto g = std::make_shared<Geometry>();
+        g->cx = (float)(NX / 4);
+        g->cy = (float)(NY / 2);
+        g->radius = radius;
+        g->obstacle.resize(NX * NY);
+        
+        for (int y = 0; y < NY; y++) {
+            for (int x = 0; x < NX; x++) {
+                float dx = x - g->cx;
+                float dy = y - g->cy;
+                g->obstacle[idx(x, y)] = (dx*dx + dy*dy <= radius*radius);
+            }
+        }
+        g->BuildLinks();
+        g->SetCircleDistances(g->cx, g->cy, radius);
+        return g;
+    }
+    
+    // Rasterizes the outlines (even-odd rule, so holes work) with sub-cell coverage
+    static std::shared_ptr<const Geometry> FromPolygons(std::vector<Polygon> outlines, WorkStealingPool& pool) {
+        auto g = std::make_shared<Geometry>();
+        g->polygons = std::move(outlines);
+        g->coverage.assign(NX * NY, 0.0f);
+        
+        pool.ParallelFor(0, NY, 8, [&](int y_begin, int y_end) {
+            std::vector<float> crossings;
+            for (int y = y_begin; y < y_end; y++) {
+                for (int s = 0; s < SubSamples; s++) {
+                    // Scanline through the s-th sub-row of cell row y
+                    float sy = y - 0.5f + (s + 0.5f) / SubSamples;
+                    crossings.clear();
+                    for (const Polygon& poly : g->polygons) {
+                        size_t n = poly.x.size();
+                        for (size_t i = 0; i < n; i++) {
+                            size_t j = (i + 1) % n;
+                            float y0 = poly.y[i], y1 = poly.y[j];
+                            if ((y0 <= sy) == (y1 <= sy)) continue;
+                            crossings.push_back(poly.x[i] + (sy - y0) * (poly.x[j] - poly.x[i]) / (y1 - y0));
+                        }
+                    }
+                    std::sort(crossings.begin(), crossings.end());
+                    
+                    // Count the sub-columns inside each span [a, b)
+                    for (size_t c = 0; c + 1 < crossings.size(); c += 2) {
+                        float a = crossings[c], b = crossings[c + 1];
+                        int first = std::max(0, (int)std::floor(a * SubSamples + 0.5f * SubSamples - 0.5f));
+                        int last = std::min(NX * SubSamples - 1, (int)std::ceil(b * SubSamples + 0.5f * SubSamples - 0.5f));
+                        for (int sub = first; sub <= last; sub++) {
+                            float sx = (sub + 0.5f) / SubSamples - 0.5f;
+                            if (sx >= a && sx < b) g->coverage[idx(sub / SubSamples, y)] += 1.0f / (SubSamples * SubSamples);
+                        }
+                    }
+                }
+            }
+        });
+        
+        g->FinishFromCoverage();
+        return g;
+    }
+    
+    // Rasterizes a grayscale mask stretched over the whole domain. Pixels brighter
+    // than 127 are solid, or darker ones when solid_is_dark is set.
+    static std::shared_ptr<const Geometry> FromMask(const std::vector<unsigned char>& pixels, int width, int height,
+                                                    bool solid_is_dark, WorkStealingPool& pool) {
+        auto g = std::make_shared<Geometry>();
+        g->coverage.assign(NX * NY, 0.0f);
+        
+        pool.ParallelFor(0, NY, 8, [&](int y_begin, int y_end) {
+            for (int y = y_begin; y < y_end; y++) {
+                for (int x = 0; x < NX; x++) {
+                    int solid = 0;
+                    for (int sy = 0; sy < SubSamples; sy++) {
+                        int py = std::min(height - 1, (int)((y + (sy + 0.5f) / SubSamples) * height / NY));
+                        for (int sx = 0; sx < SubSamples; sx++) {
+                            int px = std::min(width - 1, (int)((x + (sx + 0.5f) / SubSamples) * width / NX));
+                            bool bright = pixels[(size_t)py * width + px] > 127;
+                            solid += bright != solid_is_dark;
+                        }
+                    }
+                    g->coverage[idx(x, y)] = (float)solid / (SubSamples * SubSamples);
+                }
+            }
+        });
+        
+        g->FinishFromCoverage();
+        return g;
+    }
+    
+    // Copy of `body` inside a periodic channel: solid bottom and top rows (halfway
+    // walls at y = 0.5 and NY - 1.5) and no inlet or outlet. The walls are labelled
+    // as the last obstacle so the bodies keep their numbers.
+    static std::shared_ptr<const Geometry> Channel(const Geometry& body) {
+        auto g = std::make_shared<Geometry>(body);
+        g->periodic_x = true;
+        for (int x = 0; x < NX; x++) {
+            g->obstacle[idx(x, 0)] = true;
+            g->obstacle[idx(x, NY - 1)] = true;
+        }
+        g->BuildLinks();
+        if (!g->polygons.empty()) g->SetPolygonDistances();
+        else if (g->coverage.empty()) g->SetCircleDistances(g->cx, g->cy, g->radius);
+        
+        int walls = g->label[idx(0, 0)];
+        auto relabel = [&](int l) { return l == walls ? g->num_obstacles - 1 : (l > walls ? l - 1 : l); };
+        for (int& l : g->label) {
+            if (l >= 0) l = relabel(l);
+        }
+        for (BoundaryLink& link : g->links) link.obstacle = relabel(link.obstacle);
+        return g;
+    }
+    
+    // Sets the cells within r of (px, py) solid or fluid, then patches labels and
+    // links in a margin of 2 cells around them (enough for the upstream cells of
+    // Bouzidi links). New solid cells join an adjacent obstacle or start a new one.
+    // Untouched links keep their wall distance; new ones use q = 0.5. The inlet
+    // column and the two outlet columns stay fluid. Cells that turned fluid are
+    // appended to `uncovered`. Returns false if nothing changed.
+    bool Paint(float px, float py, float r, bool solid, std::vector<int>& uncovered) {
+        int x0 = std::max(1, (int)std::floor(px - r)), x1 = std::min(NX - 3, (int)std::ceil(px + r));
+        int y0 = (int)std::floor(py - r), y1 = std::min(y0 + NY - 1, (int)std::ceil(py + r));
+        auto wrap = [](int y) { return ((y % NY) + NY) % NY; };
+        
+        std::vector<int> flipped;
+        for (int y = y0; y <= y1; y++) {
+            for (int x = x0; x <= x1; x++) {
+                float dx = x - px, dy = y - py;
+                int id = idx(x, wrap(y));
+                if (dx*dx + dy*dy > r*r || obstacle[id] == solid) continue;
+                obstacle[id] = solid;
+                label[id] = solid ? -2 : -1;    // -2: solid, obstacle not known yet
+                flipped.push_back(id);
+                if (!solid) uncovered.push_back(id);
+            }
+        }
+        if (flipped.empty()) return false;
+        
+        // Label each connected patch of new cells after a neighbouring obstacle
+        std::vector<int> patch;
+        for (int start : flipped) {
+            if (label[start] != -2) continue;
+            patch.assign(1, start);
+            label[start] = -3;                  // Queued
+            int joined = -1;
+            for (size_t i = 0; i < patch.size(); i++) {
+                int x = patch[i] % NX, y = patch[i] / NX;
+                for (int k = 1; k <= 4; k++) {
+                    int xn = Column(x + ex[k], periodic_x);
+                    if (xn < 0) continue;
+                    int n = idx(xn, wrap(y + ey[k]));
+                    if (label[n] == -2) {
+                        label[n] = -3;
+                        patch.push_back(n);
+                    } else if (label[n] >= 0 && joined < 0) {
+                        joined = label[n];
+                    }
+                }
+            }
+            if (joined < 0) joined = num_obstacles++;
+            for (int id : patch) label[id] = joined;
+        }
+        
+        // Rebuild the links of fluid cells in the margin
+        int mx0 = std::max(0, x0 - 2), mx1 = std::min(NX - 1, x1 + 2);
+        int my0 = y0 - 2, my1 = std::min(my0 + NY - 1, y1 + 2);
+        auto in_margin = [&](int id) {
+            int x = id % NX, y = id / NX;
+            if (x < mx0 || x > mx1) return false;
+            int dy = wrap(y - my0);
+            return dy <= my1 - my0;
+        };
+        // Wall distances of the margin's old links, sorted by id * Q + k for lookup
+        std::vector<BoundaryLink> kept;
+        std::vector<std::pair<int, float>> old_q;
+        for (const BoundaryLink& link : links) {
+            if (in_margin(link.id)) old_q.emplace_back(link.id * Q + link.k, link.q);
+            else kept.push_back(link);
+        }
+        links.swap(kept);
+        std::sort(old_q.begin(), old_q.end());
+        std::sort(flipped.begin(), flipped.end());
+        
+        for (int y = my0; y <= my1; y++) {
+            for (int x = mx0; x <= mx1; x++) {
+                int id = idx(x, wrap(y));
+                if (obstacle[id]) continue;
+                for (int k = 1; k < Q; k++) {
+                    int xn = Column(x + ex[k], periodic_x);
+                    if (xn < 0) continue;
+                    int n = idx(xn, wrap(y + ey[k]));
+                    if (!obstacle[n]) continue;
+                    
+                    BoundaryLink link = {id, k, label[n]};
+                    float q = 0.5f;
+                    if (!std::binary_search(flipped.begin(), flipped.end(), n)) {
+                        auto o = std::lower_bound(old_q.begin(), old_q.end(), std::make_pair(id * Q + k, -1.0f));
+                        if (o != old_q.end() && o->first == id * Q + k) q = o->second;
+                    }
+                    SetWallDistance(link, q, obstacle, periodic_x);
+                    links.push_back(link);
+                }
+            }
+        }
+        return true;
+    }
+    
+private:
+    // Thresholds the coverage, builds the links and derives the reference size
+    // (centroid and half the frontal height of all solid cells)
+    void FinishFromCoverage() {
+        obstacle.assign(NX * NY, false);
+        double sum_x = 0.0, sum_y = 0.0;
+        int count = 0, y_min = NY, y_max = -1;
+        for (int y = 0; y < NY; y++) {
+            for (int x = 0; x < NX; x++) {
+                if (coverage[idx(x, y)] < 0.5f) continue;
+                obstacle[idx(x, y)] = true;
+                sum_x += x;
+                sum_y += y;
+                count++;
+                y_min = std::min(y_min, y);
+                y_max = std::max(y_max, y);
+            }
+        }
+        cx = count ? (float)(sum_x / count) : NX / 4.0f;
+        cy = count ? (float)(sum_y / count) : NY / 2.0f;
+        radius = count ? 0.5f * (y_max - y_min + 1) : 1.0f;
+        BuildLinks();
+        if (!polygons.empty()) SetPolygonDistances();
+    }
+};
+
+// Reads a binary (P5) or ASCII (P2) PGM image as 8-bit gray values
+inline bool LoadPGM(const std::string& path, std::vector<unsigned char>& pixels, int& width, int& height) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        std::cout << "Cannot open mask: " << path << std::endl;
+        return false;
+    }
+    
+    // Header tokens, skipping '#' comments
+    auto next_token = [&in]() {
+        std::string token;
+        while (in >> token) {
+            if (token[0] != '#') return token;
+            std::string rest;
+            std::getline(in, rest);
+        }
+        return std::string();
+    };
+    
+    std::string magic = next_token();
+    if (magic != "P5" && magic != "P2") {
+        std::cout << path << ": not a P2/P5 PGM file" << std::endl;
+        return false;
+    }
+    width = std::atoi(next_token().c_str());
+    height = std::atoi(next_token().c_str());
+    int max_value = std::atoi(next_token().c_str());
+    if (width <= 0 || height <= 0 || max_value <= 0 || max_value > 65535) {
+        std::cout << path << ": bad PGM header" << std::endl;
+        return false;
+    }
+    
+    size_t n = (size_t)width * height;
+    pixels.resize(n);
+    if (magic == "P2") {
+        for (size_t i = 0; i < n; i++) {
+            int v;
+            if (!(in >> v)) {
+                std::cout << path << ": truncated PGM data" << std::endl;
+                return false;
+            }
+            pixels[i] = (unsigned char)(v * 255 / max_value);
+        }
+        return true;
+    }
+    
+    in.get(); // Single whitespace after the header
+    int bytes = max_value > 255 ? 2 : 1;
+    std::vector<unsigned char> raw(n * bytes);
+    if (!in.read((char*)raw.data(), raw.size())) {
+        std::cout << path << ": truncated PGM data" << std::endl;
+        return false;
+    }
+    for (size_t i = 0; i < n; i++) {
+        int v = bytes == 2 ? (raw[2 * i] << 8) | raw[2 * i + 1] : raw[i];
+        pixels[i] = (unsigned char)(v * 255 / max_value);
+    }
+    return true;
+}
+
+// Parses SVG-style path data (M/L/H/V/C/Z, absolute and relative). Cubic curves are
+// flattened into 16 segments; every M or Z starts a new outline.
+inline bool ParsePathData(const std::string& data, std::vector<Polygon>& polygons) {
+    size_t pos = 0;
+    auto skip = [&]() {
+        while (pos < data.size() && (std::isspace((unsigned char)data[pos]) || data[pos] == ',')) pos++;
+    };
+    auto number = [&](float& v) {
+        skip();
+        const char* start = data.c_str() + pos;
+        char* end = nullptr;
+        v = std::strtof(start, &end);
+        if (end == start) return false;
+        pos += end - start;
+        return true;
+    };
+    
+    Polygon current;
+    float x = 0.0f, y = 0.0f, start_x = 0.0f, start_y = 0.0f;
+    char command = 0;
+    auto close = [&]() {
+        if (current.x.size() >= 3) polygons.push_back(current);
+        current = Polygon();
+    };
+    
+    while (true) {
+        skip();
+        if (pos >= data.size()) break;
+        if (std::isalpha((unsigned char)data[pos])) command = data[pos++];
+        bool relative = std::islower((unsigned char)command);
+        float ox = relative ? x : 0.0f, oy = relative ? y : 0.0f;
+        float a, b;
+        
+        switch (std::toupper((unsigned char)command)) {
+            case 'M':
+                close();
+                if (!number(a) || !number(b)) return false;
+                x = ox + a; y = oy + b;
+                start_x = x; start_y = y;
+                current.x.push_back(x); current.y.push_back(y);
+                command = relative ? 'l' : 'L'; // Further pairs are implicit line-tos
+                break;
+            case 'L':
+                if (!number(a) || !number(b)) return false;
+                x = ox + a; y = oy + b;
+                current.x.push_back(x); current.y.push_back(y);
+                break;
+            case 'H':
+                if (!number(a)) return false;
+                x = ox + a;
+                current.x.push_back(x); current.y.push_back(y);
+                break;
+            case 'V':
+                if (!number(b)) return false;
+                y = oy + b;
+                current.x.push_back(x); current.y.push_back(y);
+                break;
+            case 'C': {
+                float c[6];
+                for (float& v : c) if (!number(v)) return false;
+                float x1 = ox + c[0], y1 = oy + c[1], x2 = ox + c[2], y2 = oy + c[3];
+                float x3 = ox + c[4], y3 = oy + c[5];
+                for (int i = 1; i <= 16; i++) {
+                    float t = i / 16.0f, u = 1.0f - t;
+                    current.x.push_back(u*u*u*x + 3*u*u*t*x1 + 3*u*t*t*x2 + t*t*t*x3);
+                    current.y.push_back(u*u*u*y + 3*u*u*t*y1 + 3*u*t*t*y2 + t*t*t*y3);
+                }
+                x = x3; y = y3;
+                break;
+            }
+            case 'Z':
+                close();
+                x = start_x; y = start_y;
+                command = 0;
+                break;
+            default:
+                return false;
+        }
+    }
+    close();
+    return true;
+}
+
+// Reads outlines from a text file: either SVG-style path data, or "x y" pairs one per
+// line (airfoil .dat style) with blank lines separating outlines. Lines that do not
+// start with a number (e.g. an airfoil name) are skipped.
+inline bool LoadPolygons(const std::string& path, std::vector<Polygon>& polygons) {
+    std::ifstream in(path);
+    if (!in) {
+        std::cout << "Cannot open polygon file: " << path << std::endl;
+        return false;
+    }
+    std::stringstream buffer;
+    buffer << in.rdbuf();
+    std::string text = buffer.str();
+    
+    size_t first = text.find_first_not_of(" \t\r\n");
+    if (first != std::string::npos && (text[first] == 'M' || text[first] == 'm')) {
+        if (!ParsePathData(text, polygons)) {
+            std::cout << path << ": bad path data" << std::endl;
+            return false;
+        }
+        return !polygons.empty();
+    }
+    
+    std::stringstream lines(text);
+    std::string line;
+    Polygon current;
+    while (std::getline(lines, line)) {
+        for (char& c : line) if (c == ',' || c == ';') c = ' ';
+        std::stringstream fields(line);
+        float px, py;
+        if (fields >> px >> py) {
+            current.x.push_back(px);
+            current.y.push_back(py);
+        } else if (line.find_first_not_of(" \t\r") == std::string::npos && !current.x.empty()) {
+            if (current.x.size() >= 3) polygons.push_back(current);
+            current = Polygon();
+        }
+    }
+    if (current.x.size() >= 3) polygons.push_back(current);
+    
+    if (polygons.empty()) {
+        std::cout << path << ": no outline with at least 3 points" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Maps outline coordinates into cells: p' = offset + scale * p, with y mirrored
+// first when the file uses a y-up convention (airfoil coordinates)
+inline void TransformPolygons(std::vector<Polygon>& polygons, float scale, float offset_x, float offset_y, bool flip_y) {
+    for (Polygon& poly : polygons) {
+        for (size_t i = 0; i < poly.x.size(); i++) {
+            poly.x[i] = offset_x + scale * poly.x[i];
+            poly.y[i] = offset_y + scale * (flip_y ? -poly.y[i] : poly.y[i]);
+        }
+    }
+}
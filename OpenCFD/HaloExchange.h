@@ -0,0 +1,237 @@
+﻿/**
+ * @file HaloExchange.h
+ * @brief Pluggable halo transport between the ranks of a decomposed domain
+ *
+ * A rank owns one slab of the domain and trades its edge cells with the ranks next to
+ * it. HaloTransport is all the solver sees: ordered point-to-point messages plus a sum
+ * over all ranks for forces and divergence. Another transport (sockets, MPI) only has
+ * to implement these calls.
+ *
+ * SharedMemoryTransport connects the ranks on one machine through a named segment.
+ * Slabs only talk to the ranks next to them, so each rank has one outgoing mailbox
+ * per side. A mailbox has two slots, so a sender can be a whole message ahead of its
+ * receiver before Send has to wait. Counters are
+ * lock-free atomics in the segment. Release/acquire ordering on them publishes the
+ * payload. Waits spin briefly and then yield.
+ *
+ * A crashed run can leave its segment behind under the same name. Rank 0 stamps each
+ * segment it creates with a random nonce and releases the others only once all of
+ * them have attached, so a rank never runs on memory that no live rank 0 owns.
+ */
+
+#pragma once
+
+#include "SharedMemory.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+class HaloTransport {
+protected:
+    double wait_seconds = 0.0;           // Blocked in Send/Receive/Sum
+
+public:
+    virtual ~HaloTransport() = default;
+    virtual int Rank() const = 0;
+    virtual int Ranks() const = 0;
+    // Hands `count` floats to `peer` (rank +-1); the data may be reused on return
+    virtual void Send(int peer, const float* data, size_t count) = 0;
+    // Waits for the next message from `peer`, in the order they were sent
+    virtual void Receive(int peer, float* data, size_t count) = 0;
+    // True once the next Receive from `peer` would not wait
+    virtual bool Poll(int peer) = 0;
+    // Element-wise sum of up to 8 values over all ranks, identical on every rank.
+    // Every rank must call it the same number of times.
+    virtual void Sum(double* values, int count) = 0;
+
+    double GetWaitSeconds() const { return wait_seconds; }
+};
+
+class SharedMemoryTransport : public HaloTransport {
+public:
+    static constexpr int kMaxSum = 8;
+
+private:
+    static constexpr uint64_t kMagic = 0x314446434e45504full; // "OPENCFD1"
+    static_assert(std::atomic<uint64_t>::is_always_lock_free, "shared counters must be lock-free");
+
+    struct alignas(64) Header {
+        std::atomic<uint64_t> magic;
+        std::atomic<uint64_t> attached;
+        std::atomic<uint64_t> ready;     // Set by rank 0 once every rank has attached
+        uint64_t nonce;                  // Random per created segment
+        uint64_t ranks;
+        uint64_t capacity;
+    };
+    struct alignas(64) Mailbox {
+        std::atomic<uint64_t> sent;                 // Messages published
+        alignas(64) std::atomic<uint64_t> received; // Messages copied out
+    };
+    struct alignas(64) SumSlot {
+        std::atomic<uint64_t> generation;
+        double values[2][kMaxSum];                  // Alternating by generation
+    };
+
+    std::string name;
+    int rank, ranks;
+    size_t capacity;                     // Floats per message
+    SharedSegment segment;
+    Header* header = nullptr;
+    Mailbox* mailboxes = nullptr;        // [Box(sender, receiver)]
+    SumSlot* sums = nullptr;             // [rank]
+    float* slots = nullptr;              // [Box(sender, receiver)][2][capacity]
+    std::vector<uint64_t> sent, received;
+    uint64_t sum_generation = 0;
+
+    // Receiver is sender - 1 or sender + 1
+    static size_t Box(int sender, int receiver) { return (size_t)sender * 2 + (receiver > sender ? 1 : 0); }
+
+    size_t Bytes() const {
+        size_t pairs = (size_t)ranks * 2;
+        return sizeof(Header) + pairs * sizeof(Mailbox) + ranks * sizeof(SumSlot) + pairs * 2 * capacity * sizeof(float);
+    }
+
+    void Layout() {
+        char* base = (char*)segment.Data();
+        size_t pairs = (size_t)ranks * 2;
+        header = (Header*)base;
+        mailboxes = (Mailbox*)(base + sizeof(Header));
+        sums = (SumSlot*)(base + sizeof(Header) + pairs * sizeof(Mailbox));
+        slots = (float*)(base + sizeof(Header) + pairs * sizeof(Mailbox) + ranks * sizeof(SumSlot));
+    }
+
+    // True if `name` now maps to a ready segment other than the one with `nonce`
+    bool Replaced(uint64_t nonce) const {
+        SharedSegment current;
+        if (!current.Open(name, Bytes())) return false;
+        const Header* h = (const Header*)current.Data();
+        return h->magic.load(std::memory_order_acquire) == kMagic && h->nonce != nonce;
+    }
+
+    template <class Ready>
+    void WaitFor(Ready&& ready) {
+        if (ready()) return;
+        auto start = std::chrono::steady_clock::now();
+        for (int spin = 0; !ready(); spin++) {
+            if (spin > 256) std::this_thread::yield();
+        }
+        wait_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+public:
+    // `job` names the segment and must be the same on all ranks of one run.
+    // `max_floats` is the largest message.
+    SharedMemoryTransport(const std::string& job, int rank_id, int num_ranks, size_t max_floats)
+        : name("opencfd-" + job), rank(rank_id), ranks(num_ranks), capacity(max_floats),
+          sent(num_ranks, 0), received(num_ranks, 0) {}
+
+    // Rank 0 creates the segment, the others map it once it is ready; returns after
+    // every rank has attached, or false after `timeout_seconds`.
+    // A segment left by a crashed run is never joined: one that already has every rank
+    // attached is skipped, and a rank waiting on a segment that rank 0 never releases
+    // moves on once the name maps to a segment with another nonce.
+    bool Connect(double timeout_seconds) {
+        auto start = std::chrono::steady_clock::now();
+        auto expired = [&] {
+            return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() > timeout_seconds;
+        };
+        if (rank == 0) {
+            if (!segment.Create(name, Bytes())) return false;
+            Layout();
+            new (header) Header{};
+            for (int i = 0; i < ranks * 2; i++) new (&mailboxes[i]) Mailbox{};
+            for (int r = 0; r < ranks; r++) new (&sums[r]) SumSlot{};
+            header->nonce = ((uint64_t)std::random_device{}() << 32) ^
+                            (uint64_t)std::chrono::steady_clock::now().time_since_epoch().count();
+            header->ranks = (uint64_t)ranks;
+            header->capacity = capacity;
+            header->magic.store(kMagic, std::memory_order_release);
+            header->attached.fetch_add(1, std::memory_order_acq_rel);
+            while (header->attached.load(std::memory_order_acquire) < (uint64_t)ranks) {
+                if (expired()) return false;
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            header->ready.store(1, std::memory_order_release);
+            return true;
+        }
+        
+        for (;;) {
+            if (expired()) return false;
+            if (!segment.Open(name, Bytes())) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                continue;
+            }
+            Layout();
+            if (header->magic.load(std::memory_order_acquire) != kMagic) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                continue;
+            }
+            if (header->ranks != (uint64_t)ranks || header->capacity != capacity) return false;
+            
+            // A full count means a finished (or crashed) run: wait for rank 0 to replace it
+            uint64_t count = header->attached.load(std::memory_order_acquire);
+            bool joined = false;
+            while (count < (uint64_t)ranks && !joined) {
+                joined = header->attached.compare_exchange_weak(count, count + 1, std::memory_order_acq_rel);
+            }
+            if (!joined) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                continue;
+            }
+            
+            uint64_t nonce = header->nonce;
+            for (int wait = 1; !header->ready.load(std::memory_order_acquire); wait++) {
+                if (expired()) return false;
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                if (wait % 50 == 0 && Replaced(nonce)) break;
+            }
+            if (header->ready.load(std::memory_order_acquire)) return true;
+        }
+    }
+
+    int Rank() const override { return rank; }
+    int Ranks() const override { return ranks; }
+
+    void Send(int peer, const float* data, size_t count) override {
+        Mailbox& box = mailboxes[Box(rank, peer)];
+        uint64_t n = sent[peer]++;
+        WaitFor([&] { return n - box.received.load(std::memory_order_acquire) < 2; });
+        float* slot = slots + (Box(rank, peer) * 2 + n % 2) * capacity;
+        std::memcpy(slot, data, count * sizeof(float));
+        box.sent.store(n + 1, std::memory_order_release);
+    }
+
+    void Receive(int peer, float* data, size_t count) override {
+        Mailbox& box = mailboxes[Box(peer, rank)];
+        uint64_t n = received[peer]++;
+        WaitFor([&] { return box.sent.load(std::memory_order_acquire) > n; });
+        const float* slot = slots + (Box(peer, rank) * 2 + n % 2) * capacity;
+        std::memcpy(data, slot, count * sizeof(float));
+        box.received.store(n + 1, std::memory_order_release);
+    }
+
+    bool Poll(int peer) override {
+        return mailboxes[Box(peer, rank)].sent.load(std::memory_order_acquire) > received[peer];
+    }
+
+    // A rank can only reuse a slot two generations on, after every rank has
+    // published the generation in between and so finished reading this one
+    void Sum(double* values, int count) override {
+        uint64_t g = ++sum_generation;
+        SumSlot& mine = sums[rank];
+        std::memcpy(mine.values[g % 2], values, count * sizeof(double));
+        mine.generation.store(g, std::memory_order_release);
+        for (int i = 0; i < count; i++) values[i] = 0.0;
+        for (int r = 0; r < ranks; r++) {
+            SumSlot& theirs = sums[r];
+            WaitFor([&] { return theirs.generation.load(std::memory_order_acquire) >= g; });
+            for (int i = 0; i < count; i++) values[i] += theirs.values[g % 2][i];
+        }
+    }
+};
@@ -0,0 +1,255 @@
+﻿/**
+ * @file ImmersedBoundary.h
+ * @brief Direct-forcing immersed boundary method for thin and deforming bodies
+ *
+ * Bodies are clouds of Lagrangian markers with prescribed positions and velocities
+ * (static rings, flapping filaments). Each step the lattice velocity is interpolated
+ * to the markers with Peskin's 4-point cosine kernel. The force that drives it to
+ * the marker velocity is spread back onto an Eulerian force field, which
+ * Collision() applies. A few multi-direct-forcing passes tighten the no-slip
+ * condition where the kernels of neighbouring markers overlap.
+ *
+ * Interpolation runs in marker chunks on the pool. Spreading writes to shared cells,
+ * so markers are counting-sorted into rows and the domain is cut into row strips of
+ * roughly equal marker count. Each strip task writes only its own rows and nothing
+ * needs a lock; work stealing evens out what is left.
+ */
+
+#pragma once
+
+#include "Lattice.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+class ImmersedBoundary {
+private:
+    // Flexible plate clamped at (x0, y0) along +x, flapping with deflection
+    // amplitude * (s / length)^2 * sin(2 pi t / period)
+    struct Filament {
+        int first, count;
+        float x0, y0, length, amplitude;
+        int period;
+    };
+
+    std::vector<float> mx, my;          // Marker positions
+    std::vector<float> mu, mv;          // Prescribed marker velocities
+    std::vector<float> ds;              // Arc length (area weight) per marker
+    std::vector<float> fx_m, fy_m;      // Force density per marker, summed over passes
+    std::vector<float> dfx, dfy;        // Force increment of the current pass
+    std::vector<int> base_x, base_y;    // Lower-left stencil cell per marker (y unwrapped)
+    std::vector<float> kx, ky;          // 4 kernel weights per axis and marker
+    std::vector<float> field_x, field_y; // Eulerian force density applied in Collision()
+    std::vector<Filament> filaments;
+
+    std::vector<int> order, row_start;  // Markers sorted by row
+    std::vector<int> strips;            // Row boundaries of the spreading tasks
+    WorkStealingPool& pool;
+    int passes;
+    float total_fx, total_fy;
+
+    static constexpr float Pi = 3.14159265f;
+
+    static float Kernel(float r) {
+        r = std::fabs(r);
+        return r < 2.0f ? 0.25f * (1.0f + std::cos(0.5f * Pi * r)) : 0.0f;
+    }
+
+    static int WrapRow(int y) { return ((y % NY) + NY) % NY; }
+
+    // Stencil origin and kernel weights, shared by every forcing pass of a step
+    void ComputeWeights(int begin, int end) {
+        for (int m = begin; m < end; m++) {
+            base_x[m] = (int)std::floor(mx[m]) - 1;
+            base_y[m] = (int)std::floor(my[m]) - 1;
+            for (int i = 0; i < 4; i++) {
+                kx[4 * m + i] = Kernel(mx[m] - (base_x[m] + i));
+                ky[4 * m + i] = Kernel(my[m] - (base_y[m] + i));
+            }
+        }
+    }
+
+    void MoveMarkers(int step) {
+        for (const Filament& fil : filaments) {
+            float omega = fil.period > 0 ? 2.0f * Pi / fil.period : 0.0f;
+            float sway = std::sin(omega * step), rate = omega * std::cos(omega * step);
+            for (int i = 0; i < fil.count; i++) {
+                float s = fil.count > 1 ? (float)i / (fil.count - 1) : 0.0f;
+                int m = fil.first + i;
+                mx[m] = fil.x0 + s * fil.length;
+                my[m] = fil.y0 + fil.amplitude * s * s * sway;
+                mu[m] = 0.0f;
+                mv[m] = fil.amplitude * s * s * rate;
+            }
+        }
+    }
+
+    // Counting sort by row, then cut the rows into strips of about equal marker
+    // count (at least 4 rows, so a marker's stencil spans at most two strips)
+    void BuildStrips() {
+        int n = (int)mx.size();
+        row_start.assign(NY + 1, 0);
+        for (int m = 0; m < n; m++) row_start[WrapRow((int)std::floor(my[m])) + 1]++;
+        for (int r = 0; r < NY; r++) row_start[r + 1] += row_start[r];
+        order.resize(n);
+        std::vector<int> next(row_start.begin(), row_start.end() - 1);
+        for (int m = 0; m < n; m++) order[next[WrapRow((int)std::floor(my[m]))]++] = m;
+
+        int target = std::max(1, n / (int)(pool.Size() * 4));
+        strips.assign(1, 0);
+        int count = 0;
+        for (int r = 0; r < NY; r++) {
+            count += row_start[r + 1] - row_start[r];
+            if (count >= target && r + 1 - strips.back() >= 4 && NY - (r + 1) >= 4) {
+                strips.push_back(r + 1);
+                count = 0;
+            }
+        }
+        strips.push_back(NY);
+    }
+
+    // Velocity seen by the markers: lattice velocity plus the correction of the
+    // force spread so far, then the force increment towards the prescribed velocity
+    void InterpolateRange(int begin, int end, const float* rho, const float* ux, const float* uy) {
+        for (int m = begin; m < end; m++) {
+            int xb = base_x[m], yb = base_y[m];
+            float u = 0.0f, v = 0.0f, density = 0.0f, weight = 0.0f;
+            for (int j = 0; j < 4; j++) {
+                float wy = ky[4 * m + j];
+                int row = WrapRow(yb + j) * NX;
+                for (int i = 0; i < 4; i++) {
+                    int x = xb + i;
+                    if (x < 0 || x >= NX) continue;
+                    float wgt = wy * kx[4 * m + i];
+                    int id = row + x;
+                    u += wgt * (ux[id] + field_x[id] / rho[id]);
+                    v += wgt * (uy[id] + field_y[id] / rho[id]);
+                    density += wgt * rho[id];
+                    weight += wgt;
+                }
+            }
+            if (weight > 0.0f) {
+                u /= weight;
+                v /= weight;
+                density /= weight;
+            }
+            dfx[m] = density * (mu[m] - u);
+            dfy[m] = density * (mv[m] - v);
+            fx_m[m] += dfx[m];
+            fy_m[m] += dfy[m];
+        }
+    }
+
+    // Adds the force increments of every marker whose stencil reaches rows [y0, y1)
+    void SpreadStrip(int y0, int y1) {
+        // Markers in rows y0-2 .. y1 reach the strip; each row is visited once
+        int first = y0 - 2, last = y1;
+        if (last - first + 1 >= NY) {
+            first = 0;
+            last = NY - 1;
+        }
+        for (int r = first; r <= last; r++) {
+            int row = WrapRow(r);
+            for (int o = row_start[row]; o < row_start[row + 1]; o++) {
+                int m = order[o];
+                int xb = base_x[m], yb = base_y[m];
+                for (int j = 0; j < 4; j++) {
+                    int wrapped = WrapRow(yb + j);
+                    if (wrapped < y0 || wrapped >= y1) continue;
+                    float wy = ky[4 * m + j] * ds[m];
+                    for (int i = 0; i < 4; i++) {
+                        int x = xb + i;
+                        if (x < 0 || x >= NX) continue;
+                        float wgt = wy * kx[4 * m + i];
+                        field_x[wrapped * NX + x] += wgt * dfx[m];
+                        field_y[wrapped * NX + x] += wgt * dfy[m];
+                    }
+                }
+            }
+        }
+    }
+
+    int AddMarker(float x, float y, float arc) {
+        mx.push_back(x);
+        my.push_back(y);
+        mu.push_back(0.0f);
+        mv.push_back(0.0f);
+        ds.push_back(arc);
+        return (int)mx.size() - 1;
+    }
+
+public:
+    explicit ImmersedBoundary(WorkStealingPool& pool_, int passes_ = 3)
+        : pool(pool_), passes(std::max(1, passes_)), total_fx(0.0f), total_fy(0.0f) {
+        field_x.assign(NX * NY, 0.0f);
+        field_y.assign(NX * NY, 0.0f);
+    }
+
+    // Static ring of markers about one cell apart
+    void AddCircle(float cx, float cy, float r) {
+        int n = std::max(8, (int)std::ceil(2.0f * Pi * r));
+        for (int i = 0; i < n; i++) {
+            float a = 2.0f * Pi * i / n;
+            AddMarker(cx + r * std::cos(a), cy + r * std::sin(a), 2.0f * Pi * r / n);
+        }
+    }
+
+    // Flapping filament of the given length, markers about one cell apart
+    void AddFilament(float x0, float y0, float length, float amplitude, int period) {
+        Filament fil = {(int)mx.size(), std::max(2, (int)std::ceil(length) + 1), x0, y0, length, amplitude, period};
+        for (int i = 0; i < fil.count; i++) AddMarker(x0, y0, length / (fil.count - 1));
+        filaments.push_back(fil);
+        MoveMarkers(0);
+    }
+
+    // Moves the markers to `step`, then rebuilds the force field from the current
+    // macroscopic fields (before collision)
+    void Update(int step, const float* rho, const float* ux, const float* uy) {
+        int n = (int)mx.size();
+        MoveMarkers(step);
+        BuildStrips();
+        fx_m.assign(n, 0.0f);
+        fy_m.assign(n, 0.0f);
+        dfx.resize(n);
+        dfy.resize(n);
+        base_x.resize(n);
+        base_y.resize(n);
+        kx.resize(4 * n);
+        ky.resize(4 * n);
+
+        int grain = std::max(256, n / (int)(pool.Size() * 4));
+        pool.ParallelFor(0, n, grain, [&](int begin, int end) { ComputeWeights(begin, end); });
+
+        int num_strips = (int)strips.size() - 1;
+        pool.ParallelFor(0, num_strips, 1, [&](int begin, int end) {
+            std::fill(field_x.begin() + strips[begin] * NX, field_x.begin() + strips[end] * NX, 0.0f);
+            std::fill(field_y.begin() + strips[begin] * NX, field_y.begin() + strips[end] * NX, 0.0f);
+        });
+
+        for (int pass = 0; pass < passes; pass++) {
+            pool.ParallelFor(0, n, grain, [&](int begin, int end) { InterpolateRange(begin, end, rho, ux, uy); });
+            pool.ParallelFor(0, num_strips, 1, [&](int begin, int end) {
+                for (int s = begin; s < end; s++) SpreadStrip(strips[s], strips[s + 1]);
+            });
+        }
+
+        // The fluid pushes on the bodies with the opposite of the spread force
+        total_fx = 0.0f;
+        total_fy = 0.0f;
+        for (int m = 0; m < n; m++) {
+            total_fx -= fx_m[m] * ds[m];
+            total_fy -= fy_m[m] * ds[m];
+        }
+    }
+
+    const float* ForceX() const { return field_x.data(); }
+    const float* ForceY() const { return field_y.data(); }
+    size_t Size() const { return mx.size(); }
+    float X(size_t m) const { return mx[m]; }
+    float Y(size_t m) const { return my[m]; }
+
+    // Total hydrodynamic force on all immersed bodies, last step
+    float GetForceX() const { return total_fx; }
+    float GetForceY() const { return total_fy; }
+};
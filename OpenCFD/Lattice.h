@@ -0,0 +1,82 @@
+﻿/**
+ * @file Lattice.h
+ * @brief D2Q9 lattice constants, domain size and per-case simulation parameters
+ *
+ * Shared by every solver variant so they all stream and collide on the same lattice.
+ */
+
+#pragma once
+
+#include <cmath>
+
+// Domain size
+const int NX = 400;
+const int NY = 200;
+const int Q = 9;
+
+// D2Q9 lattice vectors and weights
+const int ex[Q] = {0, 1, 0, -1, 0, 1, -1, -1, 1};
+const int ey[Q] = {0, 0, 1, 0, -1, 1, 1, -1, -1};
+const float w[Q] = {4.0f/9.0f, 1.0f/9.0f, 1.0f/9.0f, 1.0f/9.0f, 1.0f/9.0f, 1.0f/36.0f, 1.0f/36.0f, 1.0f/36.0f, 1.0f/36.0f};
+const int opp[Q] = {0, 3, 4, 1, 2, 7, 8, 5, 6};
+
+inline int idx(int x, int y) { return y * NX + x; }
+
+// Edge treatments (kernels in Boundaries.h)
+enum class InletType { Equilibrium, ZouHe };
+enum class OutletType { Copy, Pressure, Convective };
+enum class SpongeProfile { Linear, Quadratic, Cubic, Cosine };
+
+// Collision operator (kernels in Collision.h)
+enum class CollisionType { BGK, TRT, MRT, CentralMoment };
+
+// Physical parameters of one simulation case
+struct SimParams {
+    float u_in = 0.1f;           // Inlet velocity (lattice units, Ma ~0.17; 0.25 diverges)
+    float Re = 1000.0f;          // Reynolds number based on cylinder diameter
+    float radius = NY / 9.0f;    // Cylinder radius (cells)
+    InletType inlet = InletType::Equilibrium;
+    OutletType outlet = OutletType::Copy;
+    int sponge = 0;              // Absorbing columns in front of the outlet (0 = off)
+    float sponge_strength = 0.1f; // Relaxation rate towards the far field at the outlet
+    SpongeProfile sponge_profile = SpongeProfile::Quadratic;
+    CollisionType collision = CollisionType::BGK;
+    float smagorinsky = 0.0f;    // Smagorinsky constant Cs of the LES subgrid model (0 = off)
+    bool limiter = false;        // Positivity limiter after collision
+    bool channel = false;        // Periodic in x between no-slip walls (no inlet/outlet)
+    float force_x = 0.0f;        // Uniform body force density (Guo forcing)
+    float force_y = 0.0f;
+    
+    // Relaxation time for this Re, clamped to the operator's stability window
+    float Tau() const {
+        float nu = u_in * (2.0f * radius) / Re;
+        float tau = 3.0f * nu + 0.5f;
+        // Minimum for stability: BGK and TRT (fixed odd rate, see Collision.h) need 0.51,
+        // MRT's damped energy moments allow much less and central moments almost none
+        float tau_min = 0.51f;
+        if (collision == CollisionType::MRT) tau_min = 0.502f;
+        else if (collision == CollisionType::CentralMoment) tau_min = 0.5001f;
+        if (smagorinsky > 0.0f && collision != CollisionType::TRT) tau_min = 0.5001f; // Eddy viscosity damps instead
+        if (tau < tau_min) tau = tau_min;
+        if (tau > 0.8f) tau = 0.8f;   // Maximum for fast motion
+        return tau;
+    }
+    
+    // Reynolds number the case actually runs at: Re itself unless Tau() had to clamp
+    float EffectiveRe() const {
+        return u_in * (2.0f * radius) / ((Tau() - 0.5f) / 3.0f);
+    }
+    bool TauClamped() const { return std::fabs(EffectiveRe() - Re) > 1e-3f * Re; }
+    
+    // Body force driving the case. A channel without an explicit force gets the one
+    // whose laminar (Poiseuille) centreline speed is u_in: F = 8 rho nu u_in / H^2,
+    // with the halfway walls H = NY - 2 apart.
+    void BodyForce(float& fx, float& fy) const {
+        fx = force_x;
+        fy = force_y;
+        if (channel && fx == 0.0f && fy == 0.0f) {
+            float H = NY - 2.0f;
+            fx = 8.0f * (Tau() - 0.5f) / 3.0f * u_in / (H * H);
+        }
+    }
+};
@@ -0,0 +1,1022 @@
+﻿/**
+ * @file MultiBlockLBM.h
+ * @brief Block-structured solver with nested 2:1 refinement around the cylinder
+ *
+ * The domain is tiled into square blocks of B x B cells, each with one ghost layer
+ * and its own populations, so every block collides and streams on its own. Level 0
+ * covers the whole domain. Each finer level halves the cell size and covers a band
+ * around the body, nested in the level below with at least one coarse cell to spare.
+ * Only the body and its wake need the fine spacing, so the cell count stays far
+ * below that of a uniform grid at the finest spacing.
+ *
+ * Levels use acoustic scaling: dx and dt halve together, so the lattice viscosity
+ * doubles per level and tau_f = 1/2 + 2 (tau_c - 1/2). Time is sub-cycled: each step
+ * of level l is followed by two steps of level l + 1.
+ *
+ * Coarse and fine overlap by one layer at the interfaces (Dupuis & Chopard 2003):
+ * - Fine ghost cells without a fine neighbour block are interpolated from the four
+ *   nearest coarse cells (weights 9/16, 3/16, 3/16, 1/16). The coarse state is taken
+ *   at t for the first sub-step and halfway between t and t + 1 for the second, and
+ *   the non-equilibrium part is scaled by tau_f / (2 tau_c).
+ * - After both sub-steps, the coarse cells under a fine block are replaced by the
+ *   average of their four children, non-equilibrium part scaled by 2 tau_c / tau_f.
+ *
+ * Each level's blocks are spread over the thread pool by cost (fluid cells, boundary
+ * links, interpolated ghosts): heaviest block first, onto the least loaded thread.
+ * Forces on the body come from the finest level covering each wall link.
+ *
+ * With SetAdaptive() the grid follows the flow. Every `interval` level-0 steps, blocks
+ * whose vorticity (velocity jump per cell, in their own lattice units) exceeds the
+ * threshold get their four children on the next level, and fine blocks that stay
+ * below a quarter of it are dropped unless the band around the body needs them.
+ * Refinement deepens by at most one level per regrid. New blocks start from the
+ * coarse level, interpolated and rescaled like ghosts. Dropped blocks lose nothing,
+ * because the coarse cells under them were restricted every step. Blocks come from a
+ * free list, so their population arrays are reused instead of reallocated.
+ *
+ * Given a HaloTransport, the solver is one rank of a decomposed run. Level 0 is split
+ * into slabs of whole block columns, and this rank steps only its own slab. A halo
+ * block on each side mirrors the neighbour's edge column. Each step collides the edge
+ * columns first, sends them, and then collides the interior while the messages
+ * travel. The halos are received at the end of the step. Decomposed runs are
+ * single-level: fine blocks would need coarse data from other ranks.
+ *
+ * Update(n) runs n single-level steps with no barrier between them. Each block's ghost
+ * fill and its collision are tasks with counters of unmet dependencies:
+ * - A fill at step t waits for the collisions at t - 1 of the block and its
+ *   neighbours, and for the halo received at t - 1 on an edge column.
+ * - A collision waits for the fills of the block and its neighbours, since it
+ *   overwrites the cells they read. An edge block also waits for the previous send
+ *   of its column.
+ * A halo goes out as soon as its column has collided, and comes in once the column
+ * has filled and the message is there. Blocks away from the rank edges keep
+ * stepping while messages are in flight, so exchange latency is hidden. Finished
+ * tasks run one ready successor inline (edge blocks first) and queue the rest.
+ */
+
+#pragma once
+
+#include "Lattice.h"
+#include "Geometry.h"
+#include "Collision.h"
+#include "ThreadPool.h"
+#include "HaloExchange.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// One B x B tile of cells at one level, padded by a ghost layer
+struct Block {
+    int level = 0;
+    int bx = 0, by = 0;                  // Block coordinates within the level
+    int size = 0;                        // Interior cells per side
+    std::vector<float> f, f_next;        // Populations [Q][(size + 2)^2], pre-collision
+    std::vector<float> f_old;            // f at the start of the step, where a finer level reads it
+    std::vector<float> rho, ux, uy;      // Moments of the last collision
+    std::vector<unsigned char> solid;    // Cell inside the body
+    std::vector<unsigned char> covered;  // Cell overwritten from the next finer level
+    std::vector<BoundaryLink> links;     // Fluid->solid links, ids are padded indices
+    bool feeds_finer = false;            // Finer ghosts are interpolated from this block
+    bool halo = false;                   // Mirror of another rank's edge column, never stepped
+    float indicator = 0.0f;              // Largest vorticity at the last regrid, lattice units
+    bool bad = false;                    // NaN/Inf/non-positive density in the last collision
+    float force_x = 0.0f;                // Momentum exchange of the last step over uncovered links
+    float force_y = 0.0f;
+    double cost = 0.0;
+
+    // Barrier-free stepping (MultiBlockLBM::Update), level 0 only
+    std::vector<int> neighbours;         // Stepped blocks whose ghosts overlap this one
+    int edge_sides = 0;                  // Bit 0/1: first/last column next to another rank
+    std::atomic<int> fill_wait{0};       // Unmet dependencies of the next fill
+    std::atomic<int> collide_wait{0};    // ... and of the next collision
+    int fill_step = 0, collide_step = 0; // Absolute steps filled/collided so far
+
+    int Stride() const { return size + 2; }
+    int Cells() const { return (size + 2) * (size + 2); }
+    int Pad(int i, int j) const { return (j + 1) * (size + 2) + (i + 1); } // i, j in [-1, size]
+    void Pointers(std::vector<float>& data, float** fp) {
+        for (int k = 0; k < Q; k++) fp[k] = data.data() + (size_t)k * Cells();
+    }
+};
+
+class MultiBlockLBM {
+private:
+    int width, height;                   // Level-0 cells
+    int block;                           // Block size B (even)
+    int levels;
+    float u_in;
+    float cx, cy, radius;                // Cylinder, level-0 cells
+    CollisionType collision;
+    std::vector<CollisionRates<1>> rates;      // Per level
+    std::vector<float> tau;
+    std::vector<std::unique_ptr<Block>> blocks;
+    std::vector<std::vector<int>> index;       // Per level: block id at [by * BlocksX + bx], -1 if absent
+    std::vector<std::vector<int>> by_level;    // Block ids per level
+    std::vector<std::vector<std::vector<int>>> schedule; // Per level and thread, heaviest block first
+    std::vector<double> imbalance;             // Per level: busiest thread / mean
+    WorkStealingPool& pool;
+    int time_step;
+    bool diverged;
+    float force_x, force_y;              // On the body over the last level-0 step, level-0 units
+    float margin;                        // Static band around the body at level 1, level-0 cells
+
+    // Dynamic refinement
+    int regrid_interval;                 // Level-0 steps between regrids, 0 = static grid
+    float refine_threshold;
+    std::vector<std::unique_ptr<Block>> spare; // Free list of dropped blocks
+    int regrids;
+    long long blocks_allocated, blocks_reused, blocks_dropped;
+    double regrid_seconds;
+
+    // Domain decomposition
+    HaloTransport* transport;            // nullptr for a single-process run
+    int first_column, end_column;        // Level-0 block columns this rank steps
+    std::vector<std::vector<int>> edge_schedule, inner_schedule; // Level 0, per thread
+    std::vector<float> halo_buffer;      // One column of the domain, [y][k]
+
+    // Barrier-free stepping (Update)
+    std::vector<int> edge_blocks[2];     // Level-0 blocks in the first/last column, by y
+    int update_end = 0;                  // Step the running Update stops at
+    std::atomic<bool> update_bad{false};
+    std::atomic<int> send_wait[2];       // Edge blocks still to collide before the next send
+    std::atomic<int> receive_wait[2];    // ... and to fill before the next receive
+    std::atomic<int> sends_ready[2], receives_ready[2];
+
+    int LevelWidth(int l) const { return width << l; }
+    int LevelHeight(int l) const { return height << l; }
+    int BlocksX(int l) const { return LevelWidth(l) / block; }
+    int BlocksY(int l) const { return LevelHeight(l) / block; }
+
+    // Block holding level cell (x, y), periodic in y; nullptr outside the domain or the level
+    Block* Find(int l, int x, int& y) const {
+        y = (y % LevelHeight(l) + LevelHeight(l)) % LevelHeight(l);
+        if (x < 0 || x >= LevelWidth(l)) return nullptr;
+        int id = index[l][(y / block) * BlocksX(l) + x / block];
+        return id < 0 ? nullptr : blocks[id].get();
+    }
+
+    // Level-l cell centre in level-0 cell coordinates
+    static float ToLevel0(int c, int l) { return (c + 0.5f) / (1 << l) - 0.5f; }
+
+    float InletProfile(float y, float min_profile) const {
+        float y_center = y - height/2.0f;
+        float profile = 1.0f - 2.0f * (y_center/(height/2.0f)) * (y_center/(height/2.0f));
+        return std::max(min_profile, profile);
+    }
+
+    static void Equilibrium(float* const* f, int p, float density, float u, float v) {
+        float usq = u*u + v*v;
+        for (int k = 0; k < Q; k++) {
+            float eu = ex[k]*u + ey[k]*v;
+            f[k][p] = w[k] * density * (1.0f + 3.0f*eu + 4.5f*eu*eu - 1.5f*usq);
+        }
+    }
+
+    // Replaces the non-equilibrium part of `g` (in place) by `scale` times itself
+    static void Rescale(float* g, float scale) {
+        float density = 0.0f, mx = 0.0f, my = 0.0f;
+        for (int k = 0; k < Q; k++) {
+            density += g[k];
+            mx += ex[k] * g[k];
+            my += ey[k] * g[k];
+        }
+        float u = mx / density, v = my / density;
+        float usq = u*u + v*v;
+        for (int k = 0; k < Q; k++) {
+            float eu = ex[k]*u + ey[k]*v;
+            float feq = w[k] * density * (1.0f + 3.0f*eu + 4.5f*eu*eu - 1.5f*usq);
+            g[k] = feq + scale * (g[k] - feq);
+        }
+    }
+
+    // Fine blocks keep one level-0 block clear of the inlet and outlet
+    bool Refinable(int l, int bx) const {
+        float s = (float)(1 << l);
+        return bx * block / s >= block && (bx + 1) * block / s <= width - block;
+    }
+
+    // Level 0 everywhere plus a band around the body that halves per level
+    void ChooseBand(std::vector<std::vector<char>>& want) const {
+        want.resize(levels);
+        for (int l = 0; l < levels; l++) want[l].assign((size_t)BlocksX(l) * BlocksY(l), 0);
+        for (int by = 0; by < BlocksY(0); by++) {
+            for (int bx = std::max(0, first_column - 1); bx <= std::min(BlocksX(0) - 1, end_column); bx++) {
+                want[0][(size_t)by * BlocksX(0) + bx] = 1;
+            }
+        }
+
+        for (int l = 1; l < levels; l++) {
+            float band = margin / (1 << (l - 1));
+            float s = (float)(1 << l);
+            for (int by = 0; by < BlocksY(l); by++) {
+                for (int bx = 0; bx < BlocksX(l); bx++) {
+                    if (!Refinable(l, bx)) continue;
+                    float x_lo = bx * block / s, x_hi = (bx + 1) * block / s;
+                    float y_lo = by * block / s, y_hi = (by + 1) * block / s;
+                    float dx = std::max(0.0f, std::max(x_lo - cx, cx - x_hi));
+                    float dy = std::max(0.0f, std::max(y_lo - cy, cy - y_hi));
+                    if (std::sqrt(dx*dx + dy*dy) < radius + band) want[l][(size_t)by * BlocksX(l) + bx] = 1;
+                }
+            }
+        }
+    }
+
+    // Adds the coarse blocks that the footprint of each fine block plus one coarse
+    // cell needs on the level below, from the finest level down
+    void CloseNesting(std::vector<std::vector<char>>& want) const {
+        for (int l = levels - 1; l >= 1; l--) {
+            for (int by = 0; by < BlocksY(l); by++) {
+                for (int bx = 0; bx < BlocksX(l); bx++) {
+                    if (!want[l][(size_t)by * BlocksX(l) + bx]) continue;
+                    ForEachCoarseNeighbour(l, bx, by, [&](int cbx, int cby) {
+                        want[l - 1][(size_t)cby * BlocksX(l - 1) + cbx] = 1;
+                    });
+                }
+            }
+        }
+    }
+
+    // Coarse blocks touched by the footprint of fine block (bx, by) plus one coarse cell
+    template <class Visit>
+    void ForEachCoarseNeighbour(int l, int bx, int by, Visit&& visit) const {
+        int half = block / 2;
+        auto floor_div = [](int a, int b) { return a >= 0 ? a / b : -((-a + b - 1) / b); };
+        int x_lo = floor_div(bx * half - 1, block), x_hi = floor_div((bx + 1) * half, block);
+        int y_lo = floor_div(by * half - 1, block), y_hi = floor_div((by + 1) * half, block);
+        for (int cby = y_lo; cby <= y_hi; cby++) {
+            for (int cbx = std::max(0, x_lo); cbx <= std::min(BlocksX(l - 1) - 1, x_hi); cbx++) {
+                visit(cbx, (cby + BlocksY(l - 1)) % BlocksY(l - 1));
+            }
+        }
+    }
+
+    void BuildBlock(Block& b) {
+        int B = block, l = b.level, n = b.Cells();
+        b.f.assign((size_t)Q * n, 0.0f);
+        b.f_next.assign((size_t)Q * n, 0.0f);
+        b.rho.assign(n, 1.0f);
+        b.ux.assign(n, 0.0f);
+        b.uy.assign(n, 0.0f);
+        b.solid.assign(n, 0);
+        b.covered.assign(n, 0);
+
+        // Cylinder at this level's spacing; at level 0 this is Geometry::Cylinder
+        float s = (float)(1 << l);
+        float lcx = (cx + 0.5f) * s - 0.5f, lcy = (cy + 0.5f) * s - 0.5f, lr = radius * s;
+        for (int j = -1; j <= B; j++) {
+            for (int i = -1; i <= B; i++) {
+                int x = b.bx * B + i, y = b.by * B + j;
+                if (x < 0 || x >= LevelWidth(l)) continue;
+                y = (y % LevelHeight(l) + LevelHeight(l)) % LevelHeight(l);
+                float dx = x - lcx, dy = y - lcy;
+                b.solid[b.Pad(i, j)] = dx*dx + dy*dy <= lr*lr;
+            }
+        }
+
+        b.links.clear();
+        for (int j = 0; j < B; j++) {
+            for (int i = 0; i < B; i++) {
+                int p = b.Pad(i, j);
+                if (b.solid[p]) continue;
+                int x = b.bx * B + i, y = b.by * B + j;
+                for (int k = 1; k < Q; k++) {
+                    if (!b.solid[b.Pad(i + ex[k], j + ey[k])]) continue;
+                    BoundaryLink link = {p, k, 0};
+                    int up = b.Pad(i - ex[k], j - ey[k]);
+                    link.upstream = b.solid[up] ? -1 : up;
+                    float q = Geometry::CircleLinkDistance(x - lcx, y - lcy, (float)ex[k], (float)ey[k], lr);
+                    Geometry::SetLinkWeights(link, q > 0.0f ? q : 0.5f);
+                    b.links.push_back(link);
+                }
+            }
+        }
+    }
+
+    // Largest |dv/dx - du/dy| over the fluid cells, from the moments of the last collision
+    float Vorticity(const Block& b) const {
+        int B = block, S = b.Stride();
+        float largest = 0.0f;
+        for (int j = 0; j < B; j++) {
+            for (int i = 0; i < B; i++) {
+                int p = b.Pad(i, j);
+                if (b.solid[p] || b.solid[p - 1] || b.solid[p + 1] || b.solid[p - S] || b.solid[p + S]) continue;
+                float curl = 0.5f * (b.uy[p + 1] - b.uy[p - 1]) - 0.5f * (b.ux[p + S] - b.ux[p - S]);
+                largest = std::max(largest, std::fabs(curl));
+            }
+        }
+        return largest;
+    }
+
+    std::unique_ptr<Block> AcquireBlock() {
+        if (spare.empty()) {
+            blocks_allocated++;
+            return std::make_unique<Block>();
+        }
+        blocks_reused++;
+        std::unique_ptr<Block> b = std::move(spare.back());
+        spare.pop_back();
+        return b;
+    }
+
+    // Makes the block set match `want`: kept blocks stay in place, dropped ones go to
+    // the free list, and new ones are built (and with `fill`, interpolated from the
+    // level below, coarsest first so new coarse blocks exist before their children)
+    void ApplyGrid(const std::vector<std::vector<char>>& want, bool fill) {
+        std::vector<std::unique_ptr<Block>> old;
+        old.swap(blocks);
+        std::vector<std::vector<int>> old_index = index;
+        index.assign(levels, std::vector<int>());
+        by_level.assign(levels, std::vector<int>());
+
+        std::vector<int> fresh;
+        for (int l = 0; l < levels; l++) {
+            index[l].assign(want[l].size(), -1);
+            for (size_t at = 0; at < want[l].size(); at++) {
+                int was = old_index.empty() ? -1 : old_index[l][at];
+                if (!want[l][at]) {
+                    if (was >= 0) {
+                        spare.push_back(std::move(old[was]));
+                        blocks_dropped++;
+                    }
+                    continue;
+                }
+                std::unique_ptr<Block> b;
+                if (was >= 0) {
+                    b = std::move(old[was]);
+                } else {
+                    b = AcquireBlock();
+                    b->level = l;
+                    b->bx = (int)(at % BlocksX(l));
+                    b->by = (int)(at / BlocksX(l));
+                    b->size = block;
+                    BuildBlock(*b);
+                    fresh.push_back((int)blocks.size());
+                }
+                b->feeds_finer = false;
+                b->halo = l == 0 && (b->bx < first_column || b->bx >= end_column);
+                std::fill(b->covered.begin(), b->covered.end(), 0);
+                index[l][at] = (int)blocks.size();
+                if (!b->halo) by_level[l].push_back((int)blocks.size());
+                blocks.push_back(std::move(b));
+            }
+        }
+
+        // Which coarse cells are recomputed from a finer level, and which coarse
+        // blocks the finer ghosts read
+        int half = block / 2;
+        for (int l = 1; l < levels; l++) {
+            for (int id : by_level[l]) {
+                const Block& fine = *blocks[id];
+                ForEachCoarseNeighbour(l, fine.bx, fine.by, [&](int cbx, int cby) {
+                    blocks[index[l - 1][(size_t)cby * BlocksX(l - 1) + cbx]]->feeds_finer = true;
+                });
+                int y = fine.by * half;
+                Block* c = Find(l - 1, fine.bx * half, y);
+                int off_x = fine.bx * half - c->bx * block, off_y = y - c->by * block;
+                for (int j = 0; j < half; j++) {
+                    for (int i = 0; i < half; i++) c->covered[c->Pad(off_x + i, off_y + j)] = 1;
+                }
+            }
+        }
+        for (auto& b : blocks) {
+            if (b->feeds_finer) b->f_old.resize(b->f.size());
+        }
+
+        // All levels sit at the same time between level-0 steps, so f_old = f
+        if (fill) {
+            for (auto& b : blocks) {
+                if (b->feeds_finer) b->f_old = b->f;
+            }
+            for (int id : fresh) {
+                Block& b = *blocks[id];
+                if (b.level == 0) continue;
+                float* fp[Q];
+                b.Pointers(b.f, fp);
+                for (int j = 0; j < block; j++) {
+                    for (int i = 0; i < block; i++) {
+                        int p = b.Pad(i, j);
+                        if (!b.solid[p]) Interpolate(b.level, b.bx * block + i, b.by * block + j, 0.0f, fp, p);
+                    }
+                }
+                if (b.feeds_finer) b.f_old = b.f;
+            }
+        }
+
+        for (auto& b : blocks) b->cost = BlockCost(*b);
+        BuildSchedule();
+    }
+
+    // Refines where the vorticity is high and coarsens where it has died down,
+    // never below the static band
+    void Regrid() {
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::vector<char>> want;
+        ChooseBand(want);
+        float coarsen_threshold = 0.25f * refine_threshold;
+        for (auto& b : blocks) {
+            int l = b->level;
+            b->indicator = Vorticity(*b);
+            if (l >= 1 && b->indicator >= coarsen_threshold) want[l][(size_t)b->by * BlocksX(l) + b->bx] = 1;
+            if (l + 1 < levels && b->indicator > refine_threshold) {
+                for (int c = 0; c < 4; c++) {
+                    int cbx = 2 * b->bx + (c & 1), cby = 2 * b->by + (c >> 1);
+                    if (Refinable(l + 1, cbx)) want[l + 1][(size_t)cby * BlocksX(l + 1) + cbx] = 1;
+                }
+            }
+        }
+        CloseNesting(want);
+
+        bool changed = false;
+        for (int l = 0; l < levels && !changed; l++) {
+            for (size_t at = 0; at < want[l].size() && !changed; at++) changed = (want[l][at] != 0) != (index[l][at] >= 0);
+        }
+        if (changed) ApplyGrid(want, true);
+        regrids++;
+        regrid_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // Cost model for the scheduler: cells, plus wall links and interpolated ghosts
+    // that each take a few cells' worth of work
+    double BlockCost(const Block& b) const {
+        int B = block, fluid = 0, interpolated = 0;
+        for (int j = 0; j < B; j++) {
+            for (int i = 0; i < B; i++) fluid += !b.solid[b.Pad(i, j)];
+        }
+        if (b.level > 0) {
+            for (int j = -1; j <= B; j++) {
+                for (int i = -1; i <= B; i++) {
+                    if (i >= 0 && i < B && j >= 0 && j < B) continue;
+                    int y = b.by * B + j;
+                    if (!Find(b.level, b.bx * B + i, y)) interpolated++;
+                }
+            }
+        }
+        return fluid + 2.0 * b.links.size() + 4.0 * interpolated;
+    }
+
+    // Longest-processing-time assignment of blocks to the threads; returns the
+    // busiest thread's load over the mean
+    double Assign(std::vector<int> ids, std::vector<std::vector<int>>& shares) const {
+        unsigned threads = pool.Size();
+        shares.assign(threads, std::vector<int>());
+        std::sort(ids.begin(), ids.end(), [&](int a, int b) { return blocks[a]->cost > blocks[b]->cost; });
+        std::vector<double> load(threads, 0.0);
+        for (int id : ids) {
+            unsigned t = (unsigned)(std::min_element(load.begin(), load.end()) - load.begin());
+            shares[t].push_back(id);
+            load[t] += blocks[id]->cost;
+        }
+        double total = 0.0, busiest = 0.0;
+        for (double v : load) {
+            total += v;
+            busiest = std::max(busiest, v);
+        }
+        return total > 0.0 ? busiest / (total / threads) : 1.0;
+    }
+
+    void BuildSchedule() {
+        schedule.resize(levels);
+        imbalance.resize(levels);
+        for (int l = 0; l < levels; l++) imbalance[l] = Assign(by_level[l], schedule[l]);
+
+        // Level-0 dependencies for Update: the stepped blocks around each block
+        for (int side = 0; side < 2; side++) edge_blocks[side].clear();
+        for (int id : by_level[0]) {
+            Block& b = *blocks[id];
+            b.neighbours.clear();
+            for (int dy = -1; dy <= 1; dy++) {
+                for (int dx = -1; dx <= 1; dx++) {
+                    int x = b.bx + dx, y = ((b.by + dy) % BlocksY(0) + BlocksY(0)) % BlocksY(0);
+                    if (x < 0 || x >= BlocksX(0)) continue;
+                    int n = index[0][(size_t)y * BlocksX(0) + x];
+                    if (n >= 0 && n != id && !blocks[n]->halo) b.neighbours.push_back(n);
+                }
+            }
+            std::sort(b.neighbours.begin(), b.neighbours.end());
+            b.neighbours.erase(std::unique(b.neighbours.begin(), b.neighbours.end()), b.neighbours.end());
+            b.edge_sides = 0;
+            if (transport && b.bx == first_column && first_column > 0) b.edge_sides |= 1;
+            if (transport && b.bx == end_column - 1 && end_column < BlocksX(0)) b.edge_sides |= 2;
+        }
+        for (int by = 0; by < BlocksY(0) && transport; by++) {
+            if (first_column > 0) edge_blocks[0].push_back(index[0][(size_t)by * BlocksX(0) + first_column]);
+            if (end_column < BlocksX(0)) edge_blocks[1].push_back(index[0][(size_t)by * BlocksX(0) + end_column - 1]);
+        }
+        if (!transport) return;
+
+        // Edge columns go first so their halos can be sent before the interior runs
+        std::vector<int> edge, inner;
+        for (int id : by_level[0]) (blocks[id]->edge_sides ? edge : inner).push_back(id);
+        Assign(edge, edge_schedule);
+        Assign(inner, inner_schedule);
+    }
+
+    // Runs fn on every block of the shares, one task per thread's share
+    template <class Fn>
+    void RunShares(const std::vector<std::vector<int>>& shares, Fn&& fn) {
+        for (const std::vector<int>& share : shares) {
+            if (share.empty()) continue;
+            pool.Submit([this, &share, &fn] {
+                for (int id : share) fn(*blocks[id]);
+            });
+        }
+        pool.Wait();
+    }
+
+    template <class Fn>
+    void RunLevel(int l, Fn&& fn) { RunShares(schedule[l], fn); }
+
+    // Rank on side 0 (left) or 1 (right), -1 at the domain edge or without a transport
+    int Peer(int side) const {
+        if (!transport) return -1;
+        int peer = transport->Rank() + (side ? 1 : -1);
+        return peer < 0 || peer >= transport->Ranks() ? -1 : peer;
+    }
+
+    // Sends this rank's first/last column of level-0 cells to the rank on that side
+    void SendEdge(int side) {
+        int B = block, i = side ? B - 1 : 0;
+        for (int by = 0; by < BlocksY(0); by++) {
+            Block& b = *blocks[edge_blocks[side][by]];
+            for (int j = 0; j < B; j++) {
+                float* out = &halo_buffer[((size_t)by * B + j) * Q];
+                for (int k = 0; k < Q; k++) out[k] = b.f[(size_t)k * b.Cells() + b.Pad(i, j)];
+            }
+        }
+        transport->Send(Peer(side), halo_buffer.data(), halo_buffer.size());
+    }
+
+    // Fills the halo blocks' facing column with the neighbour's edge
+    void ReceiveHalo(int side) {
+        int B = block, i = side ? 0 : B - 1;
+        int bx = side ? end_column : first_column - 1;
+        transport->Receive(Peer(side), halo_buffer.data(), halo_buffer.size());
+        for (int by = 0; by < BlocksY(0); by++) {
+            Block& b = *blocks[index[0][(size_t)by * BlocksX(0) + bx]];
+            for (int j = 0; j < B; j++) {
+                const float* in = &halo_buffer[((size_t)by * B + j) * Q];
+                for (int k = 0; k < Q; k++) b.f[(size_t)k * b.Cells() + b.Pad(i, j)] = in[k];
+            }
+        }
+    }
+
+    void SendEdges() {
+        for (int side = 0; side < 2; side++) {
+            if (Peer(side) >= 0) SendEdge(side);
+        }
+    }
+
+    void ReceiveHalos() {
+        for (int side = 0; side < 2; side++) {
+            if (Peer(side) >= 0) ReceiveHalo(side);
+        }
+    }
+
+    void Collide(Block& b) {
+        DispatchCollision(collision, rates[b.level].smagorinsky > 0.0f, [&](auto op) { CollideStream<decltype(op)>(b); });
+    }
+
+    static int SideCount(const Block& b) { return (b.edge_sides & 1) + (b.edge_sides >> 1); }
+    int FillNeed(const Block& b) const { return 1 + (int)b.neighbours.size() + SideCount(b); }
+    int CollideNeed(const Block& b) const { return 1 + (int)b.neighbours.size() + SideCount(b); }
+
+    // Meets one dependency of the block's next fill (phase 0) or collision (phase 1).
+    // The last one re-arms the counter and makes the task ready if its step is in the run.
+    void Release(int id, int phase, std::vector<int>& ready) {
+        Block& b = *blocks[id];
+        std::atomic<int>& wait = phase ? b.collide_wait : b.fill_wait;
+        if (wait.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+        wait.fetch_add(phase ? CollideNeed(b) : FillNeed(b), std::memory_order_relaxed);
+        if ((phase ? b.collide_step : b.fill_step) < update_end) ready.push_back(id * 2 + phase);
+    }
+
+    void RunTask(int task) {
+        std::vector<int> ready;
+        for (;;) {
+            int id = task / 2;
+            Block& b = *blocks[id];
+            ready.clear();
+            if (task % 2 == 0) {
+                FillGhosts(b, 0.0f);
+                b.fill_step++;
+                Release(id, 1, ready);
+                for (int n : b.neighbours) Release(n, 1, ready);
+                for (int side = 0; side < 2; side++) {
+                    if (!(b.edge_sides >> side & 1)) continue;
+                    if (receive_wait[side].fetch_sub(1, std::memory_order_acq_rel) != 1) continue;
+                    receive_wait[side].fetch_add(BlocksY(0), std::memory_order_relaxed);
+                    receives_ready[side].fetch_add(1, std::memory_order_release);
+                }
+            } else {
+                Collide(b);
+                if (b.bad) update_bad = true;
+                b.collide_step++;
+                Release(id, 0, ready);
+                for (int n : b.neighbours) Release(n, 0, ready);
+                for (int side = 0; side < 2; side++) {
+                    if (!(b.edge_sides >> side & 1)) continue;
+                    if (send_wait[side].fetch_sub(1, std::memory_order_acq_rel) != 1) continue;
+                    send_wait[side].fetch_add(BlocksY(0), std::memory_order_relaxed);
+                    sends_ready[side].fetch_add(1, std::memory_order_release);
+                }
+            }
+            if (ready.empty()) return;
+
+            // Continue with an edge block if one is ready, queue the rest
+            auto next = std::find_if(ready.begin(), ready.end(), [&](int t) { return blocks[t / 2]->edge_sides != 0; });
+            if (next == ready.end()) next = ready.begin();
+            task = *next;
+            for (int t : ready) {
+                if (t != task) pool.Submit([this, t] { RunTask(t); });
+            }
+        }
+    }
+
+    // Pre-collision ghost values: same-level neighbour, coarse interpolation at time
+    // t + blend (in coarse steps), or the inlet/outlet treatment at the domain edge
+    void FillGhosts(Block& b, float blend) {
+        int B = block, l = b.level;
+        float* fp[Q];
+        b.Pointers(b.f, fp);
+        for (int j = -1; j <= B; j++) {
+            for (int i = -1; i <= B; i++) {
+                if (i >= 0 && i < B && j >= 0 && j < B) continue;
+                int p = b.Pad(i, j);
+                if (b.solid[p]) continue;
+                int x = b.bx * B + i, y = b.by * B + j;
+                Block* n = Find(l, x, y);
+                if (n) {
+                    int q = n->Pad(x - n->bx * B, y - n->by * B);
+                    for (int k = 0; k < Q; k++) fp[k][p] = n->f[(size_t)k * n->Cells() + q];
+                } else if (x < 0) {
+                    Equilibrium(fp, p, 1.0f, u_in * InletProfile((float)y, 0.3f), 0.0f);
+                } else if (x >= LevelWidth(l)) {
+                    for (int k = 0; k < Q; k++) fp[k][p] = fp[k][b.Pad(i - 1, j)];
+                } else {
+                    Interpolate(l, x, y, blend, fp, p);
+                }
+            }
+        }
+    }
+
+    void Interpolate(int l, int x, int y, float blend, float* const* out, int p) const {
+        int c_x = x >> 1, c_y = y >> 1;
+        int sx = (x & 1) ? 1 : -1, sy = (y & 1) ? 1 : -1;
+        const int ox[4] = {0, sx, 0, sx}, oy[4] = {0, 0, sy, sy};
+        const float weight[4] = {9.0f/16.0f, 3.0f/16.0f, 3.0f/16.0f, 1.0f/16.0f};
+
+        float g[Q] = {};
+        float total = 0.0f;
+        for (int s = 0; s < 4; s++) {
+            int xs = c_x + ox[s], ys = c_y + oy[s];
+            Block* c = Find(l - 1, xs, ys);
+            if (!c) continue;
+            int q = c->Pad(xs - c->bx * block, ys - c->by * block);
+            if (c->solid[q]) continue;
+            for (int k = 0; k < Q; k++) {
+                size_t at = (size_t)k * c->Cells() + q;
+                float v = c->f_old[at] + blend * (c->f[at] - c->f_old[at]);
+                g[k] += weight[s] * v;
+            }
+            total += weight[s];
+        }
+        if (total == 0.0f) return;
+        for (int k = 0; k < Q; k++) g[k] /= total;
+        Rescale(g, tau[l] / (2.0f * tau[l - 1]));
+        for (int k = 0; k < Q; k++) out[k][p] = g[k];
+    }
+
+    template <class Operator>
+    void CollideStream(Block& b) {
+        int B = block, S = b.Stride(), n = b.Cells(), l = b.level;
+        float* fp[Q];
+        float* np[Q];
+        b.Pointers(b.f, fp);
+        b.Pointers(b.f_next, np);
+
+        // Ghosts included: interior cells pull their post-collision values
+        b.bad = false;
+        for (int p = 0; p < n; p++) {
+            if (b.solid[p]) continue;
+            float density = 0.0f, mx = 0.0f, my = 0.0f;
+            for (int k = 0; k < Q; k++) {
+                density += fp[k][p];
+                mx += ex[k] * fp[k][p];
+                my += ey[k] * fp[k][p];
+            }
+            if (!(density > 0.0f && density <= std::numeric_limits<float>::max())) b.bad = true;
+            b.rho[p] = density;
+            b.ux[p] = mx / density;
+            b.uy[p] = my / density;
+            Operator::template Relax<1>(fp, p, &b.rho[p], &b.ux[p], &b.uy[p], rates[l]);
+        }
+
+        for (int j = 0; j < B; j++) {
+            for (int i = 0; i < B; i++) {
+                int p = b.Pad(i, j);
+                if (b.solid[p]) continue;
+                for (int k = 0; k < Q; k++) {
+                    int s = p - ex[k] - ey[k] * S;
+                    if (!b.solid[s]) np[k][p] = fp[k][s];
+                }
+            }
+        }
+
+        // Interpolated bounce-back, momentum exchange from uncovered cells only
+        float fx = 0.0f, fy = 0.0f;
+        for (const BoundaryLink& link : b.links) {
+            int ko = opp[link.k];
+            float fk = fp[link.k][link.id];
+            float back = link.w_near * fk + link.w_opp * fp[ko][link.id];
+            if (link.w_up != 0.0f) back += link.w_up * fp[link.k][link.upstream];
+            np[ko][link.id] = back;
+            if (b.covered[link.id]) continue;
+            fx += (fk + back) * ex[link.k];
+            fy += (fk + back) * ey[link.k];
+        }
+        b.force_x = fx;
+        b.force_y = fy;
+
+        // Equilibrium inlet and zero-gradient outlet on level 0
+        if (l == 0 && b.bx == 0) {
+            for (int j = 0; j < B; j++) {
+                float y = (float)(b.by * B + j);
+                Equilibrium(np, b.Pad(0, j), 1.0f, u_in * InletProfile(y, 0.3f), 0.0f);
+            }
+        }
+        if (l == 0 && (b.bx + 1) * B == LevelWidth(l)) {
+            for (int j = 0; j < B; j++) {
+                for (int k = 0; k < Q; k++) np[k][b.Pad(B - 1, j)] = np[k][b.Pad(B - 2, j)];
+            }
+        }
+        std::swap(b.f, b.f_next);
+    }
+
+    // Coarse cells under a fine block take the average of their children at t + 1
+    void Restrict(Block& fine) {
+        int half = block / 2, l = fine.level;
+        int x0 = fine.bx * half, y0 = fine.by * half;
+        int y_probe = y0;
+        Block* c = Find(l - 1, x0, y_probe);
+        float scale = 2.0f * tau[l - 1] / tau[l];
+        int off_x = x0 - c->bx * block, off_y = y_probe - c->by * block;
+        for (int j = 0; j < half; j++) {
+            for (int i = 0; i < half; i++) {
+                int q = c->Pad(off_x + i, off_y + j);
+                if (c->solid[q]) continue;
+                float g[Q] = {};
+                int fluid = 0;
+                for (int cj = 0; cj < 2; cj++) {
+                    for (int ci = 0; ci < 2; ci++) {
+                        int p = fine.Pad(2 * i + ci, 2 * j + cj);
+                        if (fine.solid[p]) continue;
+                        for (int k = 0; k < Q; k++) g[k] += fine.f[(size_t)k * fine.Cells() + p];
+                        fluid++;
+                    }
+                }
+                if (fluid == 0) continue;
+                for (int k = 0; k < Q; k++) g[k] /= fluid;
+                Rescale(g, scale);
+                for (int k = 0; k < Q; k++) c->f[(size_t)k * c->Cells() + q] = g[k];
+            }
+        }
+    }
+
+    // One step of level l, then two of each finer level, then restriction
+    void Advance(int l, float blend) {
+        RunLevel(l, [&](Block& b) {
+            FillGhosts(b, blend);
+            if (b.feeds_finer) b.f_old = b.f;
+        });
+        auto collide = [&](Block& b) { Collide(b); };
+        if (transport) {
+            RunShares(edge_schedule, collide);
+            SendEdges();
+            RunShares(inner_schedule, collide);
+            ReceiveHalos();
+        } else {
+            RunLevel(l, collide);
+        }
+
+        float level_scale = 1.0f / (float)(1 << (2 * l)); // Momentum per cell shrinks 4x per level
+        for (int id : by_level[l]) {
+            const Block& b = *blocks[id];
+            if (b.bad) diverged = true;
+            force_x += b.force_x * level_scale;
+            force_y += b.force_y * level_scale;
+        }
+
+        if (l + 1 < levels) {
+            Advance(l + 1, 0.0f);
+            Advance(l + 1, 0.5f);
+            RunLevel(l + 1, [&](Block& b) { Restrict(b); });
+        }
+    }
+
+public:
+    // width and height in level-0 cells, multiples of the (even) block size; the
+    // cylinder sits at (width / 4, height / 2) with params.radius in level-0 cells.
+    // `band` is the refined margin around the body at level 1, in level-0 cells.
+    // With a transport this is one rank of a single-level decomposed run, stepping
+    // its share of the level-0 block columns; all ranks must make the same calls.
+    MultiBlockLBM(const SimParams& params, int domain_width, int domain_height, int block_size,
+                  int num_levels, float band, WorkStealingPool& threads, HaloTransport* halo_transport = nullptr)
+        : width(domain_width), height(domain_height), block(block_size),
+          levels(halo_transport ? 1 : std::max(1, num_levels)),
+          u_in(params.u_in), radius(params.radius), collision(params.collision), pool(threads),
+          time_step(0), diverged(false), force_x(0.0f), force_y(0.0f), margin(band),
+          regrid_interval(0), refine_threshold(0.0f), regrids(0), blocks_allocated(0), blocks_reused(0),
+          blocks_dropped(0), regrid_seconds(0.0), transport(halo_transport), first_column(0), end_column(0) {
+        cx = (float)(width / 4);
+        cy = (float)(height / 2);
+
+        // Acoustic scaling: nu doubles in lattice units per level
+        rates.resize(levels);
+        tau.resize(levels);
+        for (int l = 0; l < levels; l++) {
+            tau[l] = 0.5f + (params.Tau() - 0.5f) * (1 << l);
+            rates[l].Set(0, tau[l]);
+            rates[l].SetSmagorinsky(params.smagorinsky);
+        }
+
+        end_column = BlocksX(0);
+        if (transport) {
+            first_column = BlocksX(0) * transport->Rank() / transport->Ranks();
+            end_column = BlocksX(0) * (transport->Rank() + 1) / transport->Ranks();
+            halo_buffer.resize((size_t)height * Q);
+        }
+
+        std::vector<std::vector<char>> want;
+        ChooseBand(want);
+        CloseNesting(want);
+        ApplyGrid(want, false);
+    }
+
+    // Same start as FastAirLBM: parabolic profile plus a perturbation behind the body
+    void Initialize() {
+        for (auto& b : blocks) {
+            float* fp[Q];
+            b->Pointers(b->f, fp);
+            int l = b->level;
+            for (int j = 0; j < block; j++) {
+                for (int i = 0; i < block; i++) {
+                    int p = b->Pad(i, j);
+                    if (b->solid[p]) continue;
+                    float x = ToLevel0(b->bx * block + i, l), y = ToLevel0(b->by * block + j, l);
+                    float u = u_in * InletProfile(y, 0.2f), v = 0.0f;
+                    if (x > cx + radius + 2 && x < cx + radius + 20) v = 0.1f * u_in * std::sin(6.28f * y / (height/4));
+                    Equilibrium(fp, p, 1.0f, u, v);
+                }
+            }
+        }
+    }
+
+    // Decomposed ranks keep stepping after a divergence so their neighbours do not wait
+    // forever; the driver stops them all at its next Sum
+    void Step() {
+        if (diverged && !transport) return;
+        force_x = 0.0f;
+        force_y = 0.0f;
+        Advance(0, 0.0f);
+        // Each level adds its sub-steps; forces are per level-0 step
+        time_step++;
+        if (regrid_interval > 0 && time_step % regrid_interval == 0 && !diverged) Regrid();
+    }
+    
+    // Runs `steps` level-0 steps. A single-level grid runs them without a barrier
+    // between steps (see the file comment); a refined grid steps level by level.
+    void Update(int steps) {
+        if (levels > 1 || steps <= 0) {
+            for (int s = 0; s < steps; s++) Step();
+            return;
+        }
+        if (diverged && !transport) return;
+
+        update_end = time_step + steps;
+        update_bad = false;
+        for (int side = 0; side < 2; side++) {
+            send_wait[side] = BlocksY(0);
+            receive_wait[side] = BlocksY(0);
+            sends_ready[side] = 0;
+            receives_ready[side] = 0;
+        }
+        // Nothing is owed to the previous Update, so the first fills start at once
+        // and the first collisions wait for no send. Every counter is armed before
+        // the first task can release one.
+        for (int id : by_level[0]) {
+            Block& b = *blocks[id];
+            b.fill_step = b.collide_step = time_step;
+            b.fill_wait = FillNeed(b);
+            b.collide_wait = CollideNeed(b) - SideCount(b);
+        }
+        // Edge blocks queued last, so each worker pops them first
+        for (int id : by_level[0]) {
+            if (!blocks[id]->edge_sides) pool.Submit([this, id] { RunTask(id * 2); });
+        }
+        for (int id : by_level[0]) {
+            if (blocks[id]->edge_sides) pool.Submit([this, id] { RunTask(id * 2); });
+        }
+
+        // This thread moves the halos: a send as soon as an edge column has collided,
+        // a receive once it has filled and the message is in
+        int sent[2] = {0, 0}, received[2] = {0, 0};
+        std::vector<int> ready;
+        for (;;) {
+            bool busy = false, progress = false;
+            ready.clear();
+            for (int side = 0; side < 2; side++) {
+                int peer = Peer(side);
+                if (peer < 0) continue;
+                busy |= sent[side] < steps || received[side] < steps;
+                if (sent[side] < sends_ready[side].load(std::memory_order_acquire)) {
+                    SendEdge(side);
+                    sent[side]++;
+                    for (int id : edge_blocks[side]) Release(id, 1, ready);
+                    progress = true;
+                }
+                if (received[side] < receives_ready[side].load(std::memory_order_acquire) && transport->Poll(peer)) {
+                    ReceiveHalo(side);
+                    received[side]++;
+                    for (int id : edge_blocks[side]) Release(id, 0, ready);
+                    progress = true;
+                }
+            }
+            for (int t : ready) pool.Submit([this, t] { RunTask(t); });
+            if (!busy) break;
+            if (!progress) std::this_thread::yield();
+        }
+        pool.Wait();
+
+        time_step = update_end;
+        force_x = 0.0f;
+        force_y = 0.0f;
+        for (int id : by_level[0]) {
+            force_x += blocks[id]->force_x;
+            force_y += blocks[id]->force_y;
+        }
+        if (update_bad) diverged = true;
+    }
+
+    // Regrid every `interval` level-0 steps (0 = keep the static band) on vorticity
+    // above `threshold`, in lattice velocity per cell of the block's level
+    void SetAdaptive(int interval, float threshold) {
+        regrid_interval = interval;
+        refine_threshold = threshold;
+    }
+
+    int GetRegrids() const { return regrids; }
+    double GetRegridSeconds() const { return regrid_seconds; }
+    long long GetBlocksAllocated() const { return blocks_allocated; }
+    long long GetBlocksReused() const { return blocks_reused; }
+    long long GetBlocksDropped() const { return blocks_dropped; }
+
+    int GetTimeStep() const { return time_step; }
+    bool HasDiverged() const { return diverged; }
+    int GetLevels() const { return levels; }
+    float GetTau(int l) const { return tau[l]; }
+    int GetBlockCount(int l) const { return (int)by_level[l].size(); }
+    // Level-0 columns [first, end) this rank steps
+    int GetFirstX() const { return first_column * block; }
+    int GetEndX() const { return end_column * block; }
+    double GetImbalance(int l) const { return imbalance[l]; }
+    long long GetCellCount(int l) const { return (long long)by_level[l].size() * block * block; }
+    long long GetCellCount() const {
+        long long cells = 0;
+        for (int l = 0; l < levels; l++) cells += GetCellCount(l);
+        return cells;
+    }
+    // Cells of a uniform grid at the finest spacing
+    long long GetUniformCellCount() const { return (long long)width * height << (2 * (levels - 1)); }
+    // Cell updates per level-0 step (finer levels run 2^l sub-steps)
+    double GetUpdatesPerStep() const {
+        double updates = 0.0;
+        for (int l = 0; l < levels; l++) updates += (double)GetCellCount(l) * (1 << l);
+        return updates;
+    }
+    float GetForceX() const { return force_x; }
+    float GetForceY() const { return force_y; }
+    float GetDragCoefficient() const { return force_x / (0.5f * u_in * u_in * 2.0f * radius); }
+    float GetLiftCoefficient() const { return force_y / (0.5f * u_in * u_in * 2.0f * radius); }
+
+    // Largest speed over the cells not covered by a finer level
+    float GetMaxSpeed() const {
+        float max_speed = 0.0f;
+        for (const auto& b : blocks) {
+            if (b->halo) continue;
+            for (int j = 0; j < block; j++) {
+                for (int i = 0; i < block; i++) {
+                    int p = b->Pad(i, j);
+                    if (b->solid[p] || b->covered[p]) continue;
+                    max_speed = std::max(max_speed, std::sqrt(b->ux[p]*b->ux[p] + b->uy[p]*b->uy[p]));
+                }
+            }
+        }
+        return max_speed;
+    }
+};
@@ -2,41 +2,154 @@
 // High-speed, low-viscosity air simulation with dynamic motion
 
 #include "OpenCFD.h"
+#include "Lattice.h"
+#include "Geometry.h"
+#include "EnsembleLBM.h"
+#include "Probes.h"
+#include "Spectral.h"
+#include "DerivedFields.h"
+#include "Tracers.h"
+#include "MovingBody.h"
+#include "ImmersedBoundary.h"
+#include "Boundaries.h"
+#include "Collision.h"
+#include "MultiBlockLBM.h"
+#include "HaloExchange.h"
+#include "ThreadPool.h"
 #include <vector>
 #include <cmath>
 #include <algorithm>
 #include <iostream>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <cctype>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <memory>
+#include <map>
+#include <array>
+#include <thread>
+#include <limits>
 
 using namespace std;
 
-// Domain size
-const int NX = 400;
-const int NY = 200;
-const int Q = 9;
+// Adaptive steps-per-frame scheduler.
+// Fits as many solver steps into each frame as the measured step cost allows,
+// leaving room for the measured render/draw overhead. In max-throughput mode
+// the frame budget is ignored and a frame is produced every render_interval steps.
+class StepScheduler {
+private:
+    double frame_budget;    // Target seconds per frame (1/60 by default)
+    double step_time;       // Smoothed seconds per solver step
+    double overhead_time;   // Smoothed seconds spent rendering/drawing per frame
+    int max_steps;          // Hard cap so a stalled frame cannot spin forever
+    int last_steps;
+    bool max_throughput;
+    int render_interval;
+
+    static double Smooth(double avg, double sample) {
+        return avg <= 0.0 ? sample : 0.9 * avg + 0.1 * sample;
+    }
+
+public:
+    StepScheduler(double budget = 1.0 / 60.0)
+        : frame_budget(budget), step_time(0.0), overhead_time(0.0), max_steps(256),
+          last_steps(0), max_throughput(false), render_interval(32) {}
+
+    // Runs step() repeatedly for one frame and returns how many steps were taken
+    template <typename StepFn>
+    int Run(StepFn&& step) {
+        using clock = chrono::steady_clock;
+        auto frame_start = clock::now();
+        double budget = max(frame_budget - overhead_time, 0.0);
+        int steps = 0;
+
+        while (true) {
+            auto t0 = clock::now();
+            step();
+            auto t1 = clock::now();
+            steps++;
+            step_time = Smooth(step_time, chrono::duration<double>(t1 - t0).count());
+
+            if (max_throughput) {
+                if (steps >= render_interval) break;
+                continue;
+            }
+
+            double elapsed = chrono::duration<double>(t1 - frame_start).count();
+            if (elapsed + step_time > budget || steps >= max_steps) break;
+        }
+
+        last_steps = steps;
+        return steps;
+    }
+
+    // Render/draw time of one frame, excluding the frame limiter's wait (which would
+    // make every budget the previous frame's step time, one step shorter each frame)
+    void RecordOverhead(double seconds) { overhead_time = Smooth(overhead_time, seconds); }
 
-// D2Q9 lattice vectors and weights
-const int ex[Q] = {0, 1, 0, -1, 0, 1, -1, -1, 1};
-const int ey[Q] = {0, 0, 1, 0, -1, 1, 1, -1, -1};
-const float w[Q] = {4.0f/9.0f, 1.0f/9.0f, 1.0f/9.0f, 1.0f/9.0f, 1.0f/9.0f, 1.0f/36.0f, 1.0f/36.0f, 1.0f/36.0f, 1.0f/36.0f};
-const int opp[Q] = {0, 3, 4, 1, 2, 7, 8, 5, 6};
+    void SetMaxThroughput(bool enabled) { max_throughput = enabled; }
+    bool IsMaxThroughput() const { return max_throughput; }
+    void SetRenderInterval(int n) { render_interval = max(1, n); }
+    int GetRenderInterval() const { return render_interval; }
 
-inline int idx(int x, int y) { return y * NX + x; }
+    int GetLastSteps() const { return last_steps; }
+    double GetStepTime() const { return step_time; }
+    double GetStepsPerSecond() const { return step_time > 0.0 ? 1.0 / step_time : 0.0; }
+};
 
 class FastAirLBM {
 private:
     vector<vector<float>> f; // Distribution functions [Q][N]
     vector<float> rho, ux, uy;
-    vector<bool> obstacle;
+    vector<float> ux_prev, uy_prev; // Velocity at the last convergence check
+    shared_ptr<const Geometry> geometry;
+    shared_ptr<Geometry> painted;    // Private copy of `geometry` once the user paints on it
+    vector<float> force_x, force_y;  // Momentum-exchange force per obstacle, last step
+    vector<float> eddy_viscosity;    // nu_t the Smagorinsky kernel applied, last step (empty without it)
+    ostream* force_stream;           // Optional time-series sink for the forces
+    ProbeSet* probes;                // Optional probes sampled every step
+    DerivedFields derived;           // Vorticity, pressure, ... computed on demand
+    TracerSet* tracers;              // Optional passive particles advected every step
+    MovingBody* body;                // Optional moving obstacle that owns `geometry`
+    ImmersedBoundary* ib;            // Optional marker bodies forcing the flow in Collision()
     vector<Color> pixels;
     
     float tau;
+    CollisionType collision;
+    CollisionRates<1> rates;
+    bool limiter;                    // Positivity limiter after relaxation
+    int limited_cells;               // Cells the limiter touched in the last collision
+    int bad_cell;                    // First cell with NaN/Inf/non-positive density, -1 while healthy
+    int bad_step;
     float u_in;
+    float radius;
     int time_step;
+    InletType inlet;
+    OutletType outlet;
+    bool channel;                    // Periodic in x between walls: no inlet or outlet
+    float drive_x, drive_y;          // Uniform body force density (Guo forcing)
+    vector<float> drive_field_x;     // Per-cell body force replacing the uniform one (empty = none)
+    vector<float> drive_field_y;
+    vector<float> outlet_prev;       // Convective outlet: last unknown populations [y][3]
+    vector<float> sponge_rate;       // Sponge blend rate per column (last columns)
+    vector<float> sponge_target;     // Far-field equilibrium [y][Q]
     
+    // Steady-state convergence check
+    int check_interval;   // Steps between residual evaluations (0 = disabled)
+    float tolerance;      // Stop once the residual drops below this
+    float residual;       // Relative L2 velocity change per step at the last check
+    bool converged;
+    
+    StepScheduler scheduler;
     Texture2D texture;
+    bool has_texture;
 
 public:
-    FastAirLBM() {
+    FastAirLBM(const SimParams& params = SimParams(), shared_ptr<const Geometry> geom = nullptr, bool verbose = true) {
         int N = NX * NY;
         
         // Initialize distribution functions
@@ -48,45 +161,84 @@ public:
         rho.resize(N);
         ux.resize(N);
         uy.resize(N);
-        obstacle.resize(N);
+        ux_prev.resize(N);
+        uy_prev.resize(N);
         pixels.resize(N);
         
         // FAST AIR PARAMETERS - Much higher velocity, lower viscosity
-        u_in = 0.25f;  // Very high velocity for fast motion
-        float Re = 1000.0f; // High Reynolds number = low viscosity = fast moving air
-        float radius = NY / 9.0f;
-        float nu = u_in * (2.0f * radius) / Re; // Very low viscosity
-        tau = 3.0f * nu + 0.5f;
-        
-        // Force tau to be as low as possible for fast air
-        if (tau < 0.51f) tau = 0.51f; // Minimum for stability
-        if (tau > 0.8f) tau = 0.8f;   // Maximum for fast motion
+        u_in = params.u_in;
+        float Re = params.Re;
+        radius = params.radius;
+        inlet = params.inlet;
+        outlet = params.outlet;
+        channel = params.channel;
+        params.BodyForce(drive_x, drive_y);
+        outlet_prev.resize(NY * 3);
+        if (!channel) sponge_rate = SpongeRates(min(params.sponge, NX - 2), params.sponge_strength, params.sponge_profile);
+        sponge_target.resize(NY * Q);
+        for (int y = 0; y < NY; y++) {
+            float y_center = (float)y - NY/2.0f;
+            float u = u_in * max(0.3f, 1.0f - 2.0f * (y_center/(NY/2.0f)) * (y_center/(NY/2.0f)));
+            for (int k = 0; k < Q; k++) {
+                float eu = ex[k] * u;
+                sponge_target[y * Q + k] = w[k] * (1.0f + 3.0f*eu + 4.5f*eu*eu - 1.5f*u*u);
+            }
+        }
+        geometry = geom ? geom : Geometry::Cylinder(radius);
+        if (channel && !geometry->periodic_x) geometry = Geometry::Channel(*geometry);
+        force_x.assign(geometry->num_obstacles, 0.0f);
+        force_y.assign(geometry->num_obstacles, 0.0f);
+        force_stream = nullptr;
+        probes = nullptr;
+        tracers = nullptr;
+        body = nullptr;
+        ib = nullptr;
+        derived.Bind(rho, ux, uy, geometry->obstacle);
+        tau = params.Tau(); // Low viscosity, clamped for stability
+        collision = params.collision;
+        rates.Set(0, tau);
+        rates.SetSmagorinsky(params.smagorinsky);
+        eddy_viscosity.assign(params.smagorinsky > 0.0f ? (size_t)NX * NY : 0, 0.0f);
+        derived.SetEddyViscosity(eddy_viscosity.empty() ? nullptr : &eddy_viscosity);
+        limiter = params.limiter;
+        limited_cells = 0;
+        bad_cell = -1;
+        bad_step = -1;
         
         time_step = 0;
         
+        check_interval = 100;
+        tolerance = 1e-6f;
+        residual = 1.0f;
+        converged = false;
+        has_texture = false;
+        
+        if (!verbose) return;
+        
         cout << "Fast Air LBM CFD Initialized" << endl;
         cout << "Domain: " << NX << " x " << NY << endl;
-        cout << "HIGH-SPEED INLET VELOCITY: " << u_in << endl;
+        cout << "Inlet velocity: " << u_in << endl;
         cout << "HIGH Reynolds (low viscosity): " << Re << endl;
-        cout << "LOW Tau (fast air): " << tau << endl;
+        cout << "LOW Tau (fast air): " << tau << " (" << CollisionTypeName(collision);
+        if (params.smagorinsky > 0.0f) cout << " + Smagorinsky Cs " << params.smagorinsky;
+        if (limiter) cout << " + positivity limiter";
+        cout << ")" << endl;
+        if (channel) {
+            cout << "Periodic channel, body force (" << drive_x << ", " << drive_y << ")" << endl;
+        } else {
+            cout << "Inlet: " << InletTypeName(inlet) << ", outlet: " << OutletTypeName(outlet);
+            if (!sponge_rate.empty()) cout << " + " << sponge_rate.size() << "-column sponge";
+            cout << endl;
+            if (drive_x != 0.0f || drive_y != 0.0f) cout << "Body force: (" << drive_x << ", " << drive_y << ")" << endl;
+        }
         cout << "Air moves VERY FREELY and FAST!" << endl;
     }
     
     void Initialize() {
-        // Create circular obstacle
-        int cx = NX / 4;
-        int cy = NY / 2;
-        float R = NY / 9.0f;
-        
-        for (int y = 0; y < NY; y++) {
-            for (int x = 0; x < NX; x++) {
-                int id = idx(x, y);
-                
-                float dx = x - cx;
-                float dy = y - cy;
-                obstacle[id] = (dx*dx + dy*dy <= R*R);
-            }
-        }
+        // Circular obstacle comes from the (possibly shared) geometry
+        const vector<bool>& obstacle = geometry->obstacle;
+        float cx = geometry->cx;
+        float R = geometry->radius;
         
         // Initialize fast-moving air flow field
         for (int y = 0; y < NY; y++) {
@@ -103,6 +255,11 @@ public:
                     float y_center = (float)y - NY/2.0f;
                     float profile = 1.0f - 2.0f * (y_center/(NY/2.0f)) * (y_center/(NY/2.0f));
                     profile = max(0.2f, profile); // Minimum 20% speed everywhere
+                    if (channel) {
+                        // Poiseuille profile between the halfway walls
+                        float s = y - 0.5f, H = NY - 2.0f;
+                        profile = 4.0f * s * (H - s) / (H * H);
+                    }
                     
                     ux[id] = u_in * profile; // Very fast air
                     uy[id] = 0.0f;
@@ -118,10 +275,19 @@ public:
             }
         }
         
-        // Create texture
+        ux_prev = ux;
+        uy_prev = uy;
+        for (int y = 0; y < NY; y++) {
+            for (int j = 0; j < 3; j++) outlet_prev[y * 3 + j] = f[OutletUnknown[j]][idx(NX-1, y)];
+        }
+    }
+    
+    void InitTexture() {
+        // Create texture (viewer only, needs an open window)
         Image img = GenImageColor(NX, NY, BLACK);
         texture = LoadTextureFromImage(img);
         UnloadImage(img);
+        has_texture = true;
     }
     
     void ComputeEquilibrium(int id) {
@@ -136,7 +302,26 @@ public:
         }
     }
     
+    bool IsForced() const { return drive_x != 0.0f || drive_y != 0.0f || !drive_field_x.empty(); }
+    
+    void BodyForceAt(int id, float& gx, float& gy) const {
+        if (drive_field_x.empty()) {
+            gx = drive_x;
+            gy = drive_y;
+        } else {
+            gx = drive_field_x[id];
+            gy = drive_field_y[id];
+        }
+    }
+    
     void ComputeMacroscopic() {
+        const vector<bool>& obstacle = geometry->obstacle;
+        // The residual is reduced in the same pass on check steps only
+        bool check = check_interval > 0 && time_step > 0 && time_step % check_interval == 0;
+        double diff_sum = 0.0;
+        double norm_sum = 0.0;
+        bool forced = IsForced();
+        
         for (int y = 0; y < NY; y++) {
             for (int x = 0; x < NX; x++) {
                 int id = idx(x, y);
@@ -158,32 +343,104 @@ public:
                     vel_y += ey[k] * f[k][id];
                 }
                 
-                // Ensure density is positive
-                density = max(density, 1e-10f);
+                // NaN, Inf or a non-positive density: remember the first such cell, Step() halts
+                if (!(density > 0.0f && density <= numeric_limits<float>::max()) && bad_cell < 0) {
+                    bad_cell = id;
+                    bad_step = time_step;
+                }
+                
+                // Guo forcing: the velocity includes half the body force of this step
+                if (forced) {
+                    float gx, gy;
+                    BodyForceAt(id, gx, gy);
+                    vel_x += 0.5f * gx;
+                    vel_y += 0.5f * gy;
+                }
                 
                 rho[id] = density;
                 ux[id] = vel_x / density;
                 uy[id] = vel_y / density;
+                
+                if (check) {
+                    float du = ux[id] - ux_prev[id];
+                    float dv = uy[id] - uy_prev[id];
+                    diff_sum += du*du + dv*dv;
+                    norm_sum += ux[id]*ux[id] + uy[id]*uy[id];
+                    ux_prev[id] = ux[id];
+                    uy_prev[id] = uy[id];
+                }
             }
         }
+        
+        if (check) {
+            residual = (float)(sqrt(diff_sum / (norm_sum + 1e-30)) / check_interval);
+            converged = residual < tolerance;
+        }
     }
     
     void Collision() {
+        rates.eddy_viscosity = eddy_viscosity.empty() ? nullptr : eddy_viscosity.data();
+        // Operator chosen once per step; the kernel is inlined into the loop
+        DispatchCollision(collision, rates.smagorinsky > 0.0f, [this](auto op) { Collide<decltype(op)>(); });
+    }
+    
+    template <class Operator>
+    void Collide() {
+        const vector<bool>& obstacle = geometry->obstacle;
+        const float* force_field_x = ib ? ib->ForceX() : nullptr;
+        const float* force_field_y = ib ? ib->ForceY() : nullptr;
+        float* fp[Q];
+        for (int k = 0; k < Q; k++) fp[k] = f[k].data();
+        int limited = 0;
+        bool forced = IsForced();
+        
         for (int y = 0; y < NY; y++) {
             for (int x = 0; x < NX; x++) {
                 int id = idx(x, y);
                 
                 if (obstacle[id]) continue;
                 
-                float usq = ux[id]*ux[id] + uy[id]*uy[id];
+                Operator::template Relax<1>(fp, id, &rho[id], &ux[id], &uy[id], rates);
+                if (forced) {
+                    float gx, gy;
+                    BodyForceAt(id, gx, gy);
+                    GuoForce<1>(fp, id, &rho[id], &ux[id], &uy[id], &gx, &gy, rates);
+                }
+                if (limiter) limited += LimitPositivity<1>(fp, id, &rho[id], &ux[id], &uy[id]);
                 
-                for (int k = 0; k < Q; k++) {
-                    float eu = ex[k]*ux[id] + ey[k]*uy[id];
-                    float feq = w[k] * rho[id] * (1.0f + 3.0f*eu + 4.5f*eu*eu - 1.5f*usq);
-                    f[k][id] = f[k][id] - (f[k][id] - feq) / tau; // Low tau = fast relaxation = low viscosity
+                // Immersed-boundary force, exact-difference method:
+                // add feq(rho, u + F/rho) - feq(rho, u)
+                if (force_field_x && (force_field_x[id] != 0.0f || force_field_y[id] != 0.0f)) {
+                    float vx = ux[id] + force_field_x[id] / rho[id];
+                    float vy = uy[id] + force_field_y[id] / rho[id];
+                    float usq = ux[id]*ux[id] + uy[id]*uy[id];
+                    float vsq = vx*vx + vy*vy;
+                    for (int k = 1; k < Q; k++) {
+                        float eu = ex[k]*ux[id] + ey[k]*uy[id];
+                        float ev = ex[k]*vx + ey[k]*vy;
+                        f[k][id] += w[k] * rho[id] * (3.0f*(ev - eu) + 4.5f*(ev*ev - eu*eu) - 1.5f*(vsq - usq));
+                    }
+                    f[0][id] += w[0] * rho[id] * (-1.5f) * (vsq - usq);
                 }
             }
         }
+        limited_cells = limited;
+    }
+    
+    // Absorbing layer: damps the last columns towards the far field (post-collision)
+    void Sponge() {
+        if (sponge_rate.empty()) return;
+        const vector<bool>& obstacle = geometry->obstacle;
+        float* fp[Q];
+        for (int k = 0; k < Q; k++) fp[k] = f[k].data();
+        int x0 = NX - (int)sponge_rate.size();
+        for (int y = 0; y < NY; y++) {
+            for (int x = x0; x < NX; x++) {
+                int id = idx(x, y);
+                if (obstacle[id]) continue;
+                SpongeRelax<1>(fp, id, sponge_rate[x - x0], &sponge_target[y * Q]);
+            }
+        }
     }
     
     void Streaming() {
@@ -206,8 +463,9 @@ public:
                     if (y_new < 0) y_new = NY - 1;
                     if (y_new >= NY) y_new = 0;
                     
-                    // Handle left/right boundaries
-                    if (x_new >= 0 && x_new < NX) {
+                    // Handle left/right boundaries (periodic in a channel)
+                    x_new = Geometry::Column(x_new, channel);
+                    if (x_new >= 0) {
                         int id_new = idx(x_new, y_new);
                         f_temp[k][id_new] = f[k][id];
                     }
@@ -215,17 +473,19 @@ public:
             }
         }
         
-        // Handle obstacles with bounce-back
-        for (int y = 0; y < NY; y++) {
-            for (int x = 0; x < NX; x++) {
-                int id = idx(x, y);
-                
-                if (obstacle[id]) {
-                    for (int k = 0; k < Q; k++) {
-                        f_temp[k][id] = f[opp[k]][id];
-                    }
-                }
-            }
+        // Interpolated (Bouzidi) bounce-back over the precomputed boundary links.
+        // The momentum exchanged on each link, (f_k + f_opp) e_k, is summed per
+        // obstacle on the way.
+        fill(force_x.begin(), force_x.end(), 0.0f);
+        fill(force_y.begin(), force_y.end(), 0.0f);
+        for (const BoundaryLink& link : geometry->links) {
+            int ko = opp[link.k];
+            float fk = f[link.k][link.id];
+            float back = link.w_near * fk + link.w_opp * f[ko][link.id] + link.wall;
+            if (link.w_up != 0.0f) back += link.w_up * f[link.k][link.upstream];
+            f_temp[ko][link.id] = back;
+            force_x[link.obstacle] += (fk + back) * ex[link.k];
+            force_y[link.obstacle] += (fk + back) * ey[link.k];
         }
         
         // Copy back
@@ -233,6 +493,10 @@ public:
     }
     
     void BoundaryConditions() {
+        if (channel) return; // Periodic streaming closes the domain
+        float* fp[Q];
+        for (int k = 0; k < Q; k++) fp[k] = f[k].data();
+        
         // High-speed inlet boundary (left side)
         for (int y = 0; y < NY; y++) {
             int id = idx(0, y);
@@ -246,10 +510,11 @@ public:
             ux[id] = u_in * profile; // Very fast inlet
             uy[id] = 0.0f;
             
-            ComputeEquilibrium(id);
+            if (inlet == InletType::ZouHe) ZouHeVelocityInlet<1>(fp, id, &ux[id]);
+            else ComputeEquilibrium(id);
         }
         
-        // Outlet boundary (right side) - zero gradient
+        // Outlet boundary (right side): zero gradient, fixed pressure or convective
         for (int y = 0; y < NY; y++) {
             int id_out = idx(NX-1, y);
             int id_in = idx(NX-2, y);
@@ -258,74 +523,175 @@ public:
             ux[id_out] = ux[id_in];
             uy[id_out] = uy[id_in];
             
-            for (int k = 0; k < Q; k++) {
-                f[k][id_out] = f[k][id_in];
+            if (outlet == OutletType::Pressure) ZouHePressureOutlet<1>(fp, id_out, 1.0f);
+            else if (outlet == OutletType::Convective) ConvectiveOutlet<1>(fp, id_out, id_in, &ux[id_in], &outlet_prev[y * 3]);
+            else CopyOutlet<1>(fp, id_out, id_in);
+        }
+    }
+    
+    // Cells uncovered by a moving body (or erased in the viewer) start from
+    // equilibrium at the wall velocity, with the density of their fluid neighbours
+    void RefillCells(const vector<int>& cells) {
+        const vector<bool>& obstacle = geometry->obstacle;
+        for (int id : cells) {
+            int x = id % NX, y = id / NX;
+            float sum = 0.0f;
+            int count = 0;
+            for (int k = 1; k < Q; k++) {
+                int xn = Geometry::Column(x + ex[k], channel);
+                int yn = (y + ey[k] + NY) % NY;
+                if (xn < 0 || obstacle[idx(xn, yn)]) continue;
+                sum += rho[idx(xn, yn)];
+                count++;
             }
+            rho[id] = count ? sum / count : 1.0f;
+            ux[id] = 0.0f;
+            uy[id] = 0.0f;
+            if (body) body->WallVelocity((float)x, (float)y, ux[id], uy[id]);
+            ComputeEquilibrium(id);
+        }
+    }
+    
+    // Paints (solid) or erases a disk of obstacle cells between steps. The first
+    // edit copies the shared geometry; afterwards only the cells and links around
+    // the brush are touched. Moving bodies own their geometry and cannot be painted.
+    bool PaintObstacle(float x, float y, float brush, bool solid) {
+        if (body) return false;
+        if (!painted) {
+            painted = make_shared<Geometry>(*geometry);
+            geometry = painted;
+            derived.Bind(rho, ux, uy, geometry->obstacle);
+        }
+        
+        vector<int> uncovered;
+        if (!painted->Paint(x, y, brush, solid, uncovered)) return false;
+        force_x.resize(painted->num_obstacles, 0.0f);
+        force_y.resize(painted->num_obstacles, 0.0f);
+        RefillCells(uncovered);
+        derived.Invalidate();
+        converged = false;
+        return true;
+    }
+    
+    void Step() {
+        if (bad_cell >= 0) return;
+        if (body) RefillCells(body->Advance(time_step));
+        ComputeMacroscopic();
+        if (bad_cell >= 0) return; // Halted: fields stay as they were when the bad cell appeared
+        if (probes) probes->Sample(time_step, rho.data(), ux.data(), uy.data());
+        if (tracers) tracers->Advect(ux.data(), uy.data(), geometry->obstacle);
+        if (ib) ib->Update(time_step, rho.data(), ux.data(), uy.data());
+        Collision();
+        Sponge();
+        Streaming();
+        BoundaryConditions();
+        time_step++;
+        
+        if (force_stream) WriteForces(*force_stream);
+    }
+    
+    // One CSV row per obstacle: step,obstacle,fx,fy,cd,cl. Immersed-boundary
+    // bodies follow as one extra row numbered after the obstacles.
+    void WriteForces(ostream& out) {
+        for (int i = 0; i < (int)force_x.size(); i++) {
+            out << time_step << "," << i << "," << force_x[i] << "," << force_y[i] << ","
+                << GetDragCoefficient(i) << "," << GetLiftCoefficient(i) << "\n";
+        }
+        if (ib) {
+            out << time_step << "," << force_x.size() << "," << ib->GetForceX() << "," << ib->GetForceY() << ","
+                << GetImmersedDragCoefficient() << "," << GetImmersedLiftCoefficient() << "\n";
         }
     }
     
     void Update() {
-        // Multiple time steps for even faster dynamics
-        for (int step = 0; step < 2; step++) {
-            ComputeMacroscopic();
-            Collision();
-            Streaming();
-            BoundaryConditions();
+        if (converged || bad_cell >= 0) return;
+        
+        // As many time steps as fit in the frame budget (or render_interval in max-throughput mode)
+        scheduler.Run([this] { Step(); });
+    }
+    
+    // Enhanced high-contrast color mapping for fast air, norm in [0, 1]
+    static Color SequentialColor(float norm) {
+        unsigned char r, g, b;
+        
+        if (norm < 0.1f) {
+            // Very dark blue for slow/stagnant areas
+            r = 0;
+            g = 0;
+            b = (unsigned char)(50 + norm * 500);
+        } else if (norm < 0.3f) {
+            // Blue to cyan transition
+            float t = (norm - 0.1f) * 5.0f;
+            r = 0;
+            g = (unsigned char)(t * 200);
+            b = 255;
+        } else if (norm < 0.6f) {
+            // Cyan to green to yellow
+            float t = (norm - 0.3f) * 3.33f;
+            r = (unsigned char)(t * 255);
+            g = 255;
+            b = (unsigned char)(255 - t * 255);
+        } else {
+            // Yellow to bright red for very fast areas
+            float t = (norm - 0.6f) * 2.5f;
+            r = 255;
+            g = (unsigned char)(255 - t * 200);
+            b = 0;
         }
-        time_step += 2;
+        
+        return {r, g, b, 255};
     }
     
-    void Render() {
-        // Find max speed for color scaling
-        float max_speed = 0.0f;
+    // Blue - white - red for signed fields, norm in [-1, 1]
+    static Color DivergingColor(float norm) {
+        norm = max(-1.0f, min(1.0f, norm));
+        unsigned char fade = (unsigned char)(255 * (1.0f - fabs(norm)));
+        if (norm < 0.0f) return {fade, fade, 255, 255};
+        return {255, fade, fade, 255};
+    }
+    
+    void Render(DerivedField field = DerivedField::Speed) {
+        const vector<bool>& obstacle = geometry->obstacle;
+        const vector<float>& values = GetField(field);
+        bool is_signed = field == DerivedField::Vorticity || field == DerivedField::QCriterion ||
+                         field == DerivedField::Pressure;
+        
+        // Pressure is shown as the deviation from its mean
+        double mean = 0.0;
+        int fluid_cells = 0;
+        if (field == DerivedField::Pressure) {
+            for (int i = 0; i < NX*NY; i++) {
+                if (obstacle[i]) continue;
+                mean += values[i];
+                fluid_cells++;
+            }
+            mean /= max(fluid_cells, 1);
+        }
+        
+        // Find the largest magnitude for color scaling
+        float max_value = 0.0f;
         for (int i = 0; i < NX*NY; i++) {
-            if (!obstacle[i]) {
-                float speed = sqrt(ux[i]*ux[i] + uy[i]*uy[i]);
-                max_speed = max(max_speed, speed);
+            if (!obstacle[i]) max_value = max(max_value, (float)fabs(values[i] - mean));
+        }
+        // Signed fields saturate at half the peak so the wake structures stay visible
+        float scale = 1.0f / ((is_signed ? 0.5f : 1.0f) * max_value + 1e-10f);
+        
+        for (int id = 0; id < NX*NY; id++) {
+            if (obstacle[id]) {
+                pixels[id] = {80, 80, 80, 255}; // Dark gray obstacle
+            } else if (is_signed) {
+                pixels[id] = DivergingColor((float)(values[id] - mean) * scale);
+            } else {
+                pixels[id] = SequentialColor(values[id] * scale);
             }
         }
         
-        // Generate colors with enhanced contrast for fast motion
-        for (int y = 0; y < NY; y++) {
-            for (int x = 0; x < NX; x++) {
-                int id = idx(x, y);
-                
-                if (obstacle[id]) {
-                    pixels[id] = {80, 80, 80, 255}; // Dark gray obstacle
-                } else {
-                    float speed = sqrt(ux[id]*ux[id] + uy[id]*uy[id]);
-                    float norm_speed = speed / (max_speed + 1e-10f);
-                    
-                    // Enhanced high-contrast color mapping for fast air
-                    unsigned char r, g, b;
-                    
-                    if (norm_speed < 0.1f) {
-                        // Very dark blue for slow/stagnant areas
-                        r = 0;
-                        g = 0;
-                        b = (unsigned char)(50 + norm_speed * 500);
-                    } else if (norm_speed < 0.3f) {
-                        // Blue to cyan transition
-                        float t = (norm_speed - 0.1f) * 5.0f;
-                        r = 0;
-                        g = (unsigned char)(t * 200);
-                        b = 255;
-                    } else if (norm_speed < 0.6f) {
-                        // Cyan to green to yellow
-                        float t = (norm_speed - 0.3f) * 3.33f;
-                        r = (unsigned char)(t * 255);
-                        g = 255;
-                        b = (unsigned char)(255 - t * 255);
-                    } else {
-                        // Yellow to bright red for very fast areas
-                        float t = (norm_speed - 0.6f) * 2.5f;
-                        r = 255;
-                        g = (unsigned char)(255 - t * 200);
-                        b = 0;
-                    }
-                    
-                    pixels[id] = {r, g, b, 255};
-                }
+        // Tracers are splatted into the same texture upload as one batched point cloud
+        if (tracers) {
+            const vector<float>& tx = tracers->X();
+            const vector<float>& ty = tracers->Y();
+            for (int i = 0; i < tracers->Size(); i++) {
+                pixels[idx((int)tx[i], min((int)ty[i], NY - 1))] = {255, 255, 255, 255};
             }
         }
         
@@ -333,43 +699,1221 @@ public:
     }
     
     Texture2D GetTexture() { return texture; }
-    void Cleanup() { UnloadTexture(texture); }
+    void Cleanup() { if (has_texture) UnloadTexture(texture); }
     float GetMaxSpeed() { 
-        float max_speed = 0.0f;
-        for (int i = 0; i < NX*NY; i++) {
-            if (!obstacle[i]) {
-                float speed = sqrt(ux[i]*ux[i] + uy[i]*uy[i]);
-                max_speed = max(max_speed, speed);
-            }
-        }
-        return max_speed;
+        const vector<float>& speed = GetField(DerivedField::Speed);
+        return *max_element(speed.begin(), speed.end());
     }
+    
+    // Derived field for the current step; computed on first request and cached until the next step
+    const vector<float>& GetField(DerivedField field) { return derived.Get(field, time_step); }
     float GetInletSpeed() { return u_in; }
+    int GetTimeStep() { return time_step; }
+    float GetResidual() { return residual; }
+    bool IsConverged() { return converged; }
+    bool HasDiverged() const { return bad_cell >= 0; }
+    int GetLimitedCells() const { return limited_cells; }
+    
+    // Where and when the run went bad, with the populations of that cell
+    void ReportDivergence(ostream& out) const {
+        if (bad_cell < 0) return;
+        out << "DIVERGED at step " << bad_step << ": cell (" << bad_cell % NX << ", " << bad_cell / NX
+            << ") has density " << rho[bad_cell] << ", populations";
+        for (int k = 0; k < Q; k++) out << " " << f[k][bad_cell];
+        out << endl;
+    }
+    void SetConvergence(int interval, float tol) {
+        check_interval = interval;
+        tolerance = tol;
+    }
+    StepScheduler& GetScheduler() { return scheduler; }
+    float GetTau() { return tau; }
+    int GetObstacleCount() { return (int)force_x.size(); }
+    float GetForceX(int obstacle) { return force_x[obstacle]; }
+    float GetForceY(int obstacle) { return force_y[obstacle]; }
+    // Coefficients use the inlet speed and the cylinder diameter as reference
+    float GetDragCoefficient(int obstacle) { return force_x[obstacle] / (0.5f * u_in * u_in * 2.0f * radius); }
+    float GetLiftCoefficient(int obstacle) { return force_y[obstacle] / (0.5f * u_in * u_in * 2.0f * radius); }
+    float GetImmersedDragCoefficient() { return ib ? ib->GetForceX() / (0.5f * u_in * u_in * 2.0f * radius) : 0.0f; }
+    float GetImmersedLiftCoefficient() { return ib ? ib->GetForceY() / (0.5f * u_in * u_in * 2.0f * radius) : 0.0f; }
+    const Geometry& GetGeometry() { return *geometry; }
+    void SetProbes(ProbeSet* set) { probes = set; }
+    void SetTracers(TracerSet* set) { tracers = set; }
+    // The body must own the geometry this solver was built with
+    void SetMovingBody(MovingBody* moving) { body = moving; }
+    void SetImmersedBoundary(ImmersedBoundary* bodies) { ib = bodies; }
+    // Per-cell body force density [NX * NY] in place of the uniform one; empty vectors restore it
+    void SetForceField(vector<float> fx, vector<float> fy) {
+        drive_field_x = move(fx);
+        drive_field_y = move(fy);
+        if (drive_field_x.size() != (size_t)NX * NY || drive_field_y.size() != (size_t)NX * NY) {
+            drive_field_x.clear();
+            drive_field_y.clear();
+        }
+        converged = false;
+    }
+    bool HasImmersedBoundary() const { return ib != nullptr; }
+    void SetForceStream(ostream* out) {
+        force_stream = out;
+        if (out) *out << "step,obstacle,fx,fy,cd,cl\n";
+    }
     float GetReynolds() { 
-        float radius = NY / 9.0f;
         return u_in * (2.0f * radius) / ((tau - 0.5f) / 3.0f); 
     }
 };
 
-int main() {
-    InitWindow(NX*2, NY*2, "Fast Air LBM CFD - High Speed Low Viscosity");
-    SetTargetFPS(60);
+// Parameter sweep: the cartesian product of u_in x Re x radius.
+// Spec file format, one key per line ('#' starts a comment):
+//   u_in   = 0.05, 0.1          (comma separated list)
+//   re     = 20:100:20          (or start:stop:step range, inclusive)
+//   radius = 15, 22.2
+//   steps  = 50000              (max steps per case)
+//   tol    = 1e-6               (convergence tolerance, 0 = run all steps)
+//   check  = 100                (steps between residual checks)
+//   channel = 1                 (periodic channel driven by force_x/force_y)
+struct SweepSpec {
+    vector<float> u_in = {0.1f};
+    vector<float> Re = {100.0f};
+    vector<float> radius = {NY / 9.0f};
+    int max_steps = 50000;
+    int check_interval = 100;
+    float tolerance = 1e-6f;
+    InletType inlet = InletType::Equilibrium;
+    OutletType outlet = OutletType::Copy;
+    int sponge = 0;
+    float sponge_strength = 0.1f;
+    SpongeProfile sponge_profile = SpongeProfile::Quadratic;
+    CollisionType collision = CollisionType::BGK;
+    float smagorinsky = 0.0f;
+    bool limiter = false;
+    bool channel = false;
+    float force_x = 0.0f;
+    float force_y = 0.0f;
     
-    FastAirLBM sim;
+    static vector<float> ParseValues(const string& text) {
+        vector<float> values;
+        float start, stop, step;
+        if (sscanf(text.c_str(), "%f:%f:%f", &start, &stop, &step) == 3 && step > 0.0f) {
+            for (int i = 0; start + i * step <= stop + 1e-6f * step; i++) {
+                values.push_back(start + i * step);
+            }
+            return values;
+        }
+        
+        stringstream ss(text);
+        string item;
+        while (getline(ss, item, ',')) {
+            if (item.find_first_not_of(" \t") != string::npos) values.push_back(stof(item));
+        }
+        return values;
+    }
+    
+    bool Load(const string& path) {
+        ifstream in(path);
+        if (!in) {
+            cout << "Cannot open sweep spec: " << path << endl;
+            return false;
+        }
+        
+        string line;
+        int line_no = 0;
+        while (getline(in, line)) {
+            line_no++;
+            line = line.substr(0, line.find('#'));
+            size_t eq = line.find('=');
+            if (eq == string::npos) {
+                if (line.find_first_not_of(" \t\r") != string::npos) {
+                    cout << path << ":" << line_no << ": expected key = value" << endl;
+                    return false;
+                }
+                continue;
+            }
+            
+            string key = line.substr(0, eq);
+            key.erase(remove_if(key.begin(), key.end(), ::isspace), key.end());
+            string value = line.substr(eq + 1);
+            
+            try {
+                if (key == "u_in") u_in = ParseValues(value);
+                else if (key == "re") Re = ParseValues(value);
+                else if (key == "radius") radius = ParseValues(value);
+                else if (key == "steps") max_steps = stoi(value);
+                else if (key == "tol") tolerance = stof(value);
+                else if (key == "check") check_interval = stoi(value);
+                else if (key == "sponge") sponge = stoi(value);
+                else if (key == "sponge_strength") sponge_strength = stof(value);
+                else if (key == "smagorinsky") smagorinsky = stof(value);
+                else if (key == "limiter") limiter = stoi(value) != 0;
+                else if (key == "channel") channel = stoi(value) != 0;
+                else if (key == "force_x") force_x = stof(value);
+                else if (key == "force_y") force_y = stof(value);
+                else if (key == "inlet" || key == "outlet" || key == "sponge_profile" || key == "collision") {
+                    value.erase(remove_if(value.begin(), value.end(), ::isspace), value.end());
+                    bool ok = key == "inlet" ? ParseInletType(value, inlet)
+                            : key == "outlet" ? ParseOutletType(value, outlet)
+                            : key == "collision" ? ParseCollisionType(value, collision)
+                            : ParseSpongeProfile(value, sponge_profile);
+                    if (!ok) {
+                        cout << path << ":" << line_no << ": unknown " << key << " type '" << value << "'" << endl;
+                        return false;
+                    }
+                }
+                else {
+                    cout << path << ":" << line_no << ": unknown key '" << key << "'" << endl;
+                    return false;
+                }
+            } catch (const exception&) {
+                cout << path << ":" << line_no << ": bad value '" << value << "'" << endl;
+                return false;
+            }
+        }
+        
+        if (u_in.empty() || Re.empty() || radius.empty()) {
+            cout << path << ": u_in, re and radius need at least one value each" << endl;
+            return false;
+        }
+        return true;
+    }
+    
+    vector<SimParams> Cases() const {
+        vector<SimParams> cases;
+        for (float r : radius) {
+            for (float re : Re) {
+                for (float u : u_in) {
+                    SimParams p;
+                    p.u_in = u;
+                    p.Re = re;
+                    p.radius = r;
+                    p.inlet = inlet;
+                    p.outlet = outlet;
+                    p.sponge = sponge;
+                    p.sponge_strength = sponge_strength;
+                    p.sponge_profile = sponge_profile;
+                    p.collision = collision;
+                    p.smagorinsky = smagorinsky;
+                    p.limiter = limiter;
+                    p.channel = channel;
+                    p.force_x = force_x;
+                    p.force_y = force_y;
+                    cases.push_back(p);
+                }
+            }
+        }
+        return cases;
+    }
+};
+
+// One row of the sweep output table
+struct SweepResult {
+    SimParams params;
+    float tau = 0.0f;
+    float re_effective = 0.0f; // Re at the tau actually used (differs from params.Re if clamped)
+    int steps = 0;
+    bool converged = false;
+    float residual = 0.0f;
+    float max_speed = 0.0f;
+    float cd = 0.0f;         // Drag/lift coefficients of the first obstacle at the last step
+    float cl = 0.0f;
+    double seconds = 0.0;
+    int diverged_step = -1;  // Step of the first NaN/Inf/non-positive density, -1 if none
+};
+
+// Runs up to L same-geometry cases in the SIMD lanes of one EnsembleLBM
+template <int L>
+void RunEnsembleBatch(const SweepSpec& spec, const vector<SimParams>& cases, const vector<size_t>& batch,
+                      shared_ptr<const Geometry> geometry, vector<SweepResult>& results) {
+    auto t0 = chrono::steady_clock::now();
+    
+    vector<SimParams> lanes;
+    for (size_t i : batch) lanes.push_back(cases[i]);
+    
+    EnsembleLBM<L> sim(lanes, geometry);
+    sim.SetConvergence(spec.tolerance > 0.0f ? spec.check_interval : 0, spec.tolerance);
     sim.Initialize();
+    while (sim.GetTimeStep() < spec.max_steps && !sim.AllConverged()) {
+        sim.Step();
+    }
+    sim.SaveRunning();
+    
+    // Each lane reports the step it stopped at, as a separate FastAirLBM run would
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+    for (size_t l = 0; l < batch.size(); l++) {
+        SweepResult& r = results[batch[l]];
+        const typename EnsembleLBM<L>::LaneResult& lane = sim.GetResult((int)l);
+        r.params = cases[batch[l]];
+        r.tau = sim.GetTau((int)l);
+        r.re_effective = sim.GetReynolds((int)l);
+        r.converged = sim.GetConvergedStep((int)l) >= 0;
+        r.steps = lane.steps;
+        r.residual = lane.residual;
+        r.max_speed = lane.max_speed;
+        if (sim.GetObstacleCount() > 0) {
+            r.cd = lane.cd[0];
+            r.cl = lane.cl[0];
+        }
+        r.seconds = seconds / batch.size();
+        if (sim.GetDivergedStep((int)l) >= 0) {
+            r.diverged_step = lane.steps;
+            int cell = sim.GetBadCell((int)l);
+            stringstream message;
+            message << "Case " << batch[l] << " DIVERGED at step " << sim.GetDivergedStep((int)l) << ": cell ("
+                    << cell % NX << ", " << cell / NX << ")\n";
+            cout << message.str();
+        }
+    }
+}
+
+// Runs every case of the spec on a work-stealing pool, one simulation per worker.
+// Cases with the same radius share one read-only Geometry. With lanes = 8 or 16,
+// same-radius cases are packed into EnsembleLBM batches instead. An imported
+// geometry replaces the cylinder for every case (its size sets the radius).
+int RunSweep(const SweepSpec& spec, const string& out_path, unsigned num_threads, int lanes,
+             shared_ptr<const Geometry> imported) {
+    SweepSpec effective = spec;
+    if (imported) effective.radius = {imported->radius};
+    vector<SimParams> cases = effective.Cases();
+    vector<SweepResult> results(cases.size());
+    
+    // Cases whose tau falls outside the stability window run at another Re than asked
+    int clamped = 0;
+    for (size_t i = 0; i < cases.size(); i++) {
+        const SimParams& p = cases[i];
+        if (!p.TauClamped()) continue;
+        clamped++;
+        cout << "Warning: case " << i << " (u_in=" << p.u_in << " Re=" << p.Re << " radius=" << p.radius
+             << ") clamps tau to " << p.Tau() << " and runs at Re " << p.EffectiveRe() << endl;
+    }
+    if (clamped > 0) {
+        cout << clamped << " of " << cases.size() << " cases clamped; see the re_effective column" << endl;
+    }
+    
+    map<float, shared_ptr<const Geometry>> geometries;
+    for (const SimParams& p : cases) {
+        if (!geometries.count(p.radius)) geometries[p.radius] = imported ? imported : Geometry::Cylinder(p.radius);
+    }
+    
+    WorkStealingPool pool(num_threads);
+    cout << "Sweep: " << cases.size() << " cases, " << geometries.size() << " geometries, "
+         << pool.Size() << " threads" << endl;
+    
+    auto start = chrono::steady_clock::now();
+    atomic<int> done(0);
+    mutex log_lock;
+    
+    if (lanes > 0) {
+        // Cases() is ordered by radius, so consecutive cases share geometry
+        vector<vector<size_t>> batches;
+        for (size_t i = 0; i < cases.size(); i++) {
+            if (batches.empty() || (int)batches.back().size() == lanes ||
+                cases[batches.back().front()].radius != cases[i].radius) {
+                batches.emplace_back();
+            }
+            batches.back().push_back(i);
+        }
+        cout << "Ensemble mode: " << batches.size() << " batches of up to " << lanes << " lanes" << endl;
+        
+        for (const vector<size_t>& batch : batches) {
+            // Resolved here so workers never touch the shared map
+            shared_ptr<const Geometry> geometry = geometries.at(cases[batch.front()].radius);
+            pool.Submit([&, batch, geometry] {
+                if (lanes == 16) RunEnsembleBatch<16>(spec, cases, batch, geometry, results);
+                else RunEnsembleBatch<8>(spec, cases, batch, geometry, results);
+                
+                lock_guard<mutex> guard(log_lock);
+                done += (int)batch.size();
+                cout << "[" << done << "/" << cases.size() << "] batch of " << batch.size()
+                     << " cases finished" << endl;
+            });
+        }
+    }
+    
+    for (size_t i = 0; i < cases.size() && lanes == 0; i++) {
+        shared_ptr<const Geometry> geometry = geometries.at(cases[i].radius);
+        pool.Submit([&, i, geometry] {
+            auto t0 = chrono::steady_clock::now();
+            
+            FastAirLBM sim(cases[i], geometry, false);
+            sim.SetConvergence(spec.tolerance > 0.0f ? spec.check_interval : 0, spec.tolerance);
+            sim.Initialize();
+            while (sim.GetTimeStep() < spec.max_steps && !sim.IsConverged() && !sim.HasDiverged()) {
+                sim.Step();
+            }
+            
+            SweepResult& r = results[i];
+            r.params = cases[i];
+            r.tau = sim.GetTau();
+            r.re_effective = sim.GetReynolds();
+            r.steps = sim.GetTimeStep();
+            r.converged = sim.IsConverged();
+            r.residual = sim.GetResidual();
+            r.max_speed = sim.GetMaxSpeed();
+            if (sim.GetObstacleCount() > 0) {
+                r.cd = sim.GetDragCoefficient(0);
+                r.cl = sim.GetLiftCoefficient(0);
+            }
+            r.seconds = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+            if (sim.HasDiverged()) r.diverged_step = r.steps;
+            
+            lock_guard<mutex> guard(log_lock);
+            cout << "[" << ++done << "/" << cases.size() << "] u_in=" << r.params.u_in
+                 << " Re=" << r.params.Re << " radius=" << r.params.radius
+                 << (sim.HasDiverged() ? " DIVERGED" : r.converged ? " converged" : " not converged")
+                 << " at step " << r.steps << endl;
+            sim.ReportDivergence(cout);
+        });
+    }
+    pool.Wait();
+    
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    
+    ofstream out(out_path);
+    if (!out) {
+        cout << "Cannot write sweep results: " << out_path << endl;
+        return 1;
+    }
+    out << "case,u_in,re,re_effective,radius,tau,steps,converged,residual,max_speed,cd,cl,seconds,diverged_step\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const SweepResult& r = results[i];
+        out << i << "," << r.params.u_in << "," << r.params.Re << "," << r.re_effective << ","
+            << r.params.radius << ","
+            << r.tau << "," << r.steps << "," << (r.converged ? 1 : 0) << "," << r.residual << ","
+            << r.max_speed << "," << r.cd << "," << r.cl << "," << r.seconds << "," << r.diverged_step << "\n";
+    }
+    
+    cout << "Sweep finished in " << seconds << " s, results written to " << out_path << endl;
+    return 0;
+}
+
+// Geometry source selected on the command line
+struct GeometryOptions {
+    string path;                // .pgm/.png mask, or a polygon/path text file
+    float scale = 1.0f;         // Polygon coordinates -> cells
+    float offset_x = NX / 4.0f;
+    float offset_y = NY / 2.0f;
+    bool flip_y = false;        // Polygon file uses y-up coordinates (airfoils)
+    bool solid_is_dark = false; // Mask: dark pixels are solid instead of bright ones
+};
+
+static bool HasExtension(const string& path, const char* ext) {
+    string lower = path;
+    transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+    size_t n = strlen(ext);
+    return lower.size() >= n && lower.compare(lower.size() - n, n, ext) == 0;
+}
+
+// Loads and rasterizes the geometry file; returns nullptr (after printing why) on failure
+shared_ptr<const Geometry> LoadGeometry(const GeometryOptions& options, WorkStealingPool& pool) {
+    if (HasExtension(options.path, ".pgm") || HasExtension(options.path, ".png")) {
+        vector<unsigned char> pixels;
+        int width = 0, height = 0;
+        
+        if (HasExtension(options.path, ".pgm")) {
+            if (!LoadPGM(options.path, pixels, width, height)) return nullptr;
+        } else {
+            // PNG decoding comes from raylib; works without an open window
+            Image img = LoadImage(options.path.c_str());
+            if (!img.data) {
+                cout << "Cannot load mask: " << options.path << endl;
+                return nullptr;
+            }
+            ImageFormat(&img, PIXELFORMAT_UNCOMPRESSED_GRAYSCALE);
+            width = img.width;
+            height = img.height;
+            const unsigned char* gray = (const unsigned char*)img.data;
+            pixels.assign(gray, gray + (size_t)width * height);
+            UnloadImage(img);
+        }
+        return Geometry::FromMask(pixels, width, height, options.solid_is_dark, pool);
+    }
+    
+    vector<Polygon> polygons;
+    if (!LoadPolygons(options.path, polygons)) return nullptr;
+    TransformPolygons(polygons, options.scale, options.offset_x, options.offset_y, options.flip_y);
+    return Geometry::FromPolygons(move(polygons), pool);
+}
+
+// Compares L separate FastAirLBM runs against one L-lane EnsembleLBM
+template <int L>
+int BenchEnsemble(int steps) {
+    vector<SimParams> cases(L);
+    for (int l = 0; l < L; l++) {
+        cases[l].u_in = 0.05f + 0.005f * l;
+        cases[l].Re = 100.0f;
+    }
+    shared_ptr<const Geometry> geometry = Geometry::Cylinder(cases[0].radius);
+    double cell_updates = (double)NX * NY * steps * L;
+    
+    auto t0 = chrono::steady_clock::now();
+    for (int l = 0; l < L; l++) {
+        FastAirLBM sim(cases[l], geometry, false);
+        sim.Initialize();
+        for (int s = 0; s < steps; s++) sim.Step();
+    }
+    double separate = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+    
+    t0 = chrono::steady_clock::now();
+    EnsembleLBM<L> ensemble(cases, geometry);
+    ensemble.Initialize();
+    for (int s = 0; s < steps; s++) ensemble.Step();
+    double packed = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+    
+    cout << L << " cases x " << steps << " steps" << endl;
+    cout << "  separate: " << separate << " s, " << cell_updates / (separate * 1e6) << " MLUPS" << endl;
+    cout << "  ensemble: " << packed << " s, " << cell_updates / (packed * 1e6) << " MLUPS" << endl;
+    cout << "  speedup:  " << separate / packed << "x" << endl;
+    return 0;
+}
+
+// Throughput of each collision operator on the cylinder, single case and 8-lane ensemble
+int BenchCollision(int steps) {
+    const CollisionType types[] = {CollisionType::BGK, CollisionType::TRT, CollisionType::MRT, CollisionType::CentralMoment};
+    double cell_updates = (double)NX * NY * steps;
+    double bgk_single = 0.0;
+    
+    cout << "Collision operators, " << steps << " steps at Re 10000" << endl;
+    for (CollisionType type : types) {
+        SimParams params;
+        params.Re = 10000.0f;
+        params.collision = type;
+        
+        FastAirLBM sim(params, nullptr, false);
+        sim.SetConvergence(0, 0.0f);
+        sim.Initialize();
+        for (int s = 0; s < 20; s++) sim.Step(); // Warm-up, untimed
+        auto t0 = chrono::steady_clock::now();
+        for (int s = 0; s < steps; s++) sim.Step();
+        double single = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+        if (type == CollisionType::BGK) bgk_single = single;
+        
+        EnsembleLBM<8> ensemble(vector<SimParams>(8, params), Geometry::Cylinder(params.radius));
+        ensemble.SetConvergence(0, 0.0f);
+        ensemble.Initialize();
+        for (int s = 0; s < 20; s++) ensemble.Step();
+        t0 = chrono::steady_clock::now();
+        for (int s = 0; s < steps; s++) ensemble.Step();
+        double packed = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+        
+        cout << "  " << CollisionTypeName(type) << " (tau " << sim.GetTau() << "): "
+             << cell_updates / (single * 1e6) << " MLUPS single (" << bgk_single / single << "x BGK), "
+             << 8 * cell_updates / (packed * 1e6) << " MLUPS ensemble x8" << endl;
+    }
+    return 0;
+}
+
+// Time per step with and without an immersed boundary of about `markers` markers
+// (rings of radius 4 packed behind the cylinder)
+int BenchImmersed(int markers, unsigned num_threads, int steps) {
+    WorkStealingPool pool(num_threads);
+    ImmersedBoundary ib(pool);
+    for (float x = 140.0f; x < NX - 10 && (int)ib.Size() < markers; x += 11.0f) {
+        for (float y = 6.0f; y < NY - 5 && (int)ib.Size() < markers; y += 11.0f) ib.AddCircle(x, y, 4.0f);
+    }
+    double cell_updates = (double)NX * NY * steps;
+    
+    auto run = [&](bool with_ib) {
+        FastAirLBM sim(SimParams(), nullptr, false);
+        if (with_ib) sim.SetImmersedBoundary(&ib);
+        sim.SetConvergence(0, 0.0f);
+        sim.Initialize();
+        auto t0 = chrono::steady_clock::now();
+        for (int s = 0; s < steps; s++) sim.Step();
+        return chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+    };
+    double plain = run(false);
+    double forced = run(true);
+    double ib_ms = 1e3 * (forced - plain) / steps;
+    
+    cout << ib.Size() << " markers x " << steps << " steps, " << pool.Size() << " threads" << endl;
+    cout << "  solver only: " << 1e3 * plain / steps << " ms/step, " << cell_updates / (plain * 1e6) << " MLUPS" << endl;
+    cout << "  with IB:     " << 1e3 * forced / steps << " ms/step, " << cell_updates / (forced * 1e6) << " MLUPS" << endl;
+    cout << "  IB update:   " << ib_ms << " ms/step, " << ib.Size() / (ib_ms * 1e3) << " markers/us" << endl;
+    return 0;
+}
+
+// Writes one field as a legacy binary VTK structured-points file (big-endian floats)
+bool WriteFieldVTK(const string& path, const char* name, int step, const vector<float>& values) {
+    ofstream out(path, ios::binary);
+    if (!out) return false;
+    
+    out << "# vtk DataFile Version 3.0\n";
+    out << "OpenCFD " << name << " step " << step << "\n";
+    out << "BINARY\nDATASET STRUCTURED_POINTS\n";
+    out << "DIMENSIONS " << NX << " " << NY << " 1\nORIGIN 0 0 0\nSPACING 1 1 1\n";
+    out << "POINT_DATA " << NX * NY << "\nSCALARS " << name << " float 1\nLOOKUP_TABLE default\n";
+    
+    vector<unsigned char> bytes(values.size() * 4);
+    for (size_t i = 0; i < values.size(); i++) {
+        unsigned char raw[4];
+        memcpy(raw, &values[i], 4);
+        for (int b = 0; b < 4; b++) bytes[i * 4 + b] = raw[3 - b];
+    }
+    out.write((const char*)bytes.data(), bytes.size());
+    return (bool)out;
+}
+
+// Optional outputs of a headless run
+struct HeadlessOutputs {
+    string forces_path;                 // Force time series CSV
+    StrouhalAnalyzer* spectral = nullptr;
+    vector<DerivedField> fields;        // Derived fields written as VTK
+    int field_every = 1000;             // Steps between field writes
+    TracerSet* tracers = nullptr;       // Trajectories written as CSV
+    string trajectories_path;
+    int trajectory_every = 10;          // Steps between trajectory samples
+    int trajectory_stride = 100;        // Only particles with id % stride == 0
+};
+
+// Runs without a window until converged or max_steps is reached
+int RunHeadless(FastAirLBM& sim, int max_steps, const HeadlessOutputs& outputs) {
+    cout << "Headless run: up to " << max_steps << " steps" << endl;
+    const string& forces_path = outputs.forces_path;
+    StrouhalAnalyzer* spectral = outputs.spectral;
+    
+    ofstream trajectories;
+    if (outputs.tracers && !outputs.trajectories_path.empty()) {
+        trajectories.open(outputs.trajectories_path);
+        if (!trajectories) {
+            cout << "Cannot write trajectories: " << outputs.trajectories_path << endl;
+            return 1;
+        }
+        trajectories << "step,id,x,y\n";
+    }
+    
+    ofstream forces;
+    if (!forces_path.empty()) {
+        forces.open(forces_path);
+        if (!forces) {
+            cout << "Cannot write force history: " << forces_path << endl;
+            return 1;
+        }
+        sim.SetForceStream(&forces);
+    }
+    
+    auto start = chrono::steady_clock::now();
+    int last_report = -1;
+    
+    while (sim.GetTimeStep() < max_steps && !sim.IsConverged() && !sim.HasDiverged()) {
+        sim.Step();
+        
+        int t = sim.GetTimeStep();
+        if (trajectories.is_open() && t % outputs.trajectory_every == 0) {
+            outputs.tracers->WriteTrajectories(trajectories, outputs.trajectory_stride);
+        }
+        if (!outputs.fields.empty() && t % outputs.field_every == 0) {
+            for (DerivedField field : outputs.fields) {
+                string path = string(DerivedFieldName(field)) + "_" + to_string(t) + ".vtk";
+                if (!WriteFieldVTK(path, DerivedFieldName(field), t, sim.GetField(field))) {
+                    cout << "Cannot write field: " << path << endl;
+                    return 1;
+                }
+            }
+        }
+
+        if (t % 1000 == 0 && t != last_report) {
+            last_report = t;
+            cout << "Step " << t << "  residual " << sim.GetResidual();
+            if (sim.GetObstacleCount() > 0) {
+                cout << "  Cd " << sim.GetDragCoefficient(0) << "  Cl " << sim.GetLiftCoefficient(0);
+            }
+            if (sim.HasImmersedBoundary()) {
+                cout << "  IB Cd " << sim.GetImmersedDragCoefficient() << "  IB Cl " << sim.GetImmersedLiftCoefficient();
+            }
+            if (spectral && spectral->GetResult().valid) {
+                cout << "  St " << spectral->GetResult().strouhal;
+            }
+            if (sim.GetLimitedCells() > 0) cout << "  limited " << sim.GetLimitedCells();
+            cout << endl;
+        }
+    }
+    
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    double mlups = (double)NX * NY * sim.GetTimeStep() / (seconds * 1e6);
+    
+    if (sim.HasDiverged()) {
+        sim.ReportDivergence(cout);
+    } else if (sim.IsConverged()) {
+        cout << "Converged at step " << sim.GetTimeStep() << " (residual " << sim.GetResidual() << ")" << endl;
+    } else {
+        cout << "Not converged after " << sim.GetTimeStep() << " steps (residual " << sim.GetResidual() << ")" << endl;
+    }
+    cout << "Elapsed " << seconds << " s, " << mlups << " MLUPS" << endl;
+    
+    if (spectral && spectral->GetResult().valid) {
+        StrouhalAnalyzer::Result r = spectral->GetResult();
+        cout << "Strouhal " << r.strouhal << " (f = " << r.frequency << " per step, window ending at step "
+             << r.step << "), peaks:";
+        for (float f : r.peaks) cout << " " << f;
+        cout << endl;
+    }
+    
+    sim.SetForceStream(nullptr);
+    if (sim.HasDiverged()) return 2;
+    return sim.IsConverged() ? 0 : 1;
+}
+
+// Cylinder on the block-structured grid: NX x NY at level 0 plus `extra_levels`
+// nested 2:1 levels around the body, compared with a uniform grid at the finest spacing
+int RunRefined(const SimParams& params, int extra_levels, float margin, int block_size, int amr_interval, float amr_threshold,
+               int max_steps, unsigned num_threads) {
+    if (block_size < 4 || block_size % 2 != 0 || NX % block_size != 0 || NY % block_size != 0) {
+        cout << "--block-size must be even and divide " << NX << " and " << NY << endl;
+        return 1;
+    }
+    WorkStealingPool pool(num_threads);
+    MultiBlockLBM sim(params, NX, NY, block_size, 1 + extra_levels, margin, pool);
+    sim.SetAdaptive(amr_interval, amr_threshold);
+    for (int l = 0; l < sim.GetLevels(); l++) {
+        cout << "Level " << l << ": " << sim.GetBlockCount(l) << " blocks, " << sim.GetCellCount(l)
+             << " cells, tau " << sim.GetTau(l) << ", thread imbalance " << sim.GetImbalance(l) << endl;
+    }
+    cout << "Cells: " << sim.GetCellCount() << " vs " << sim.GetUniformCellCount() << " for a uniform grid at the finest spacing ("
+         << (double)sim.GetUniformCellCount() / sim.GetCellCount() << "x fewer)" << endl;
+    
+    sim.Initialize();
+    auto start = chrono::steady_clock::now();
+    while (sim.GetTimeStep() < max_steps && !sim.HasDiverged()) {
+        sim.Step();
+        if (sim.GetTimeStep() % 1000 == 0) {
+            cout << "Step " << sim.GetTimeStep() << "  Cd " << sim.GetDragCoefficient() << "  Cl " << sim.GetLiftCoefficient()
+                 << "  max speed " << sim.GetMaxSpeed();
+            if (amr_interval > 0) {
+                cout << "  blocks";
+                for (int l = 0; l < sim.GetLevels(); l++) cout << " " << sim.GetBlockCount(l);
+            }
+            cout << endl;
+        }
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    if (sim.HasDiverged()) cout << "DIVERGED at step " << sim.GetTimeStep() << endl;
+    cout << "Elapsed " << seconds << " s, " << sim.GetUpdatesPerStep() * sim.GetTimeStep() / (seconds * 1e6)
+         << " MLUPS (" << pool.Size() << " threads)" << endl;
+    if (amr_interval > 0) {
+        cout << "Regrids: " << sim.GetRegrids() << " in " << sim.GetRegridSeconds() << " s, blocks allocated "
+             << sim.GetBlocksAllocated() << ", reused " << sim.GetBlocksReused() << ", dropped " << sim.GetBlocksDropped() << endl;
+    }
+    return sim.HasDiverged() ? 2 : 0;
+}
+
+// One rank of a decomposed run: start the same command once per rank, --rank 0 to N-1
+int RunDistributed(const SimParams& params, int domain_width, int domain_height, int block_size, int rank, int ranks,
+                   const string& job, int max_steps, unsigned num_threads) {
+    if (block_size < 4 || block_size % 2 != 0 || domain_width % block_size != 0 || domain_height % block_size != 0) {
+        cout << "--block-size must be even and divide " << domain_width << " and " << domain_height << endl;
+        return 1;
+    }
+    if (rank < 0 || rank >= ranks || domain_width / block_size < ranks) {
+        cout << "--rank must be in [0, " << ranks << ") and every rank needs at least one block column" << endl;
+        return 1;
+    }
+    SharedMemoryTransport transport(job, rank, ranks, (size_t)domain_height * Q);
+    if (!transport.Connect(60.0)) {
+        cout << "Rank " << rank << ": could not connect to the other ranks of job " << job << endl;
+        return 1;
+    }
+    WorkStealingPool pool(num_threads);
+    MultiBlockLBM sim(params, domain_width, domain_height, block_size, 1, 0.0f, pool, &transport);
+    cout << "Rank " << rank << "/" << ranks << ": x " << sim.GetFirstX() << " to " << sim.GetEndX() << ", "
+         << sim.GetCellCount() << " cells" << endl;
+    
+    sim.Initialize();
+    auto start = chrono::steady_clock::now();
+    float reference = 0.5f * params.u_in * params.u_in * 2.0f * params.radius;
+    bool diverged = false;
+    while (sim.GetTimeStep() < max_steps && !diverged) {
+        // No barrier between steps up to the next report
+        sim.Update(min(1000 - sim.GetTimeStep() % 1000, max_steps - sim.GetTimeStep()));
+        // Every rank reduces at the same steps, so they all stop together
+        double totals[3] = {sim.GetForceX(), sim.GetForceY(), sim.HasDiverged() ? 1.0 : 0.0};
+        transport.Sum(totals, 3);
+        diverged = totals[2] > 0.0;
+        if (rank == 0) {
+            cout << "Step " << sim.GetTimeStep() << "  Cd " << totals[0] / reference << "  Cl " << totals[1] / reference << endl;
+        }
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    double updates = sim.GetUpdatesPerStep() * sim.GetTimeStep();
+    cout << "Rank " << rank << ": " << updates / (seconds * 1e6) << " MLUPS, " << transport.GetWaitSeconds()
+         << " s blocked in the transport" << endl;
+    transport.Sum(&updates, 1);
+    if (rank == 0) {
+        if (diverged) cout << "DIVERGED by step " << sim.GetTimeStep() << endl;
+        cout << "Elapsed " << seconds << " s, " << updates / (seconds * 1e6) << " MLUPS over " << ranks << " ranks" << endl;
+    }
+    return diverged ? 2 : 0;
+}
+
+// Strong scaling on a fixed 1600x400 domain and weak scaling on 400x400 per rank,
+// stepping with a barrier per step (Step) and without (Update). Each rank is a thread
+// of this process with its own pool and its own mapping of the shared segment, so
+// messages take the same path as between processes.
+int BenchDecomposition(int max_ranks, int steps) {
+    auto run = [&](int width, int height, int ranks, bool overlap, double& wait_fraction) {
+        string job = "bench-" + to_string(chrono::steady_clock::now().time_since_epoch().count());
+        vector<double> seconds(ranks, 0.0), waits(ranks, 0.0);
+        atomic<bool> failed(false);
+        vector<thread> threads;
+        for (int r = 0; r < ranks; r++) {
+            threads.emplace_back([&, r] {
+                SharedMemoryTransport transport(job, r, ranks, (size_t)height * Q);
+                if (!transport.Connect(10.0)) {
+                    failed = true;
+                    return;
+                }
+                WorkStealingPool pool(1);
+                MultiBlockLBM sim(SimParams(), width, height, 20, 1, 0.0f, pool, &transport);
+                sim.Initialize();
+                double ready = 0.0;
+                transport.Sum(&ready, 1); // Start together
+                double waited = transport.GetWaitSeconds();
+                auto t0 = chrono::steady_clock::now();
+                if (overlap) sim.Update(steps);
+                else for (int s = 0; s < steps; s++) sim.Step();
+                seconds[r] = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+                waits[r] = transport.GetWaitSeconds() - waited;
+            });
+        }
+        for (thread& t : threads) t.join();
+        if (failed) return 0.0;
+        double slowest = *max_element(seconds.begin(), seconds.end());
+        wait_fraction = *max_element(waits.begin(), waits.end()) / slowest;
+        return (double)width * height * steps / (slowest * 1e6);
+    };
+    
+    // MLUPS with a barrier per step, halo wait of that run, MLUPS without barriers
+    auto row = [&](int width, int ranks, double& stepped, double& wait, double& overlapped) {
+        double ignored = 0.0;
+        stepped = run(width, 400, ranks, false, wait);
+        overlapped = run(width, 400, ranks, true, ignored);
+        if (stepped == 0.0 || overlapped == 0.0) cout << "Could not set up shared memory for " << ranks << " ranks" << endl;
+        return stepped > 0.0 && overlapped > 0.0;
+    };
+    
+    cout << "Strong scaling, 1600x400, " << steps << " steps" << endl;
+    cout << "  ranks  Step MLUPS  halo wait  Update MLUPS  speedup  efficiency" << endl;
+    double base = 0.0, stepped = 0.0, wait = 0.0, overlapped = 0.0;
+    for (int ranks = 1; ranks <= max_ranks; ranks *= 2) {
+        if (!row(1600, ranks, stepped, wait, overlapped)) return 1;
+        if (ranks == 1) base = overlapped;
+        printf("  %5d  %10.1f  %8.1f%%  %12.1f  %7.2f  %9.0f%%\n", ranks, stepped, 100.0 * wait, overlapped,
+               overlapped / base, 100.0 * overlapped / (base * ranks));
+    }
+    cout << "Weak scaling, 400x400 per rank, " << steps << " steps" << endl;
+    cout << "  ranks  domain     Step MLUPS  halo wait  Update MLUPS  efficiency" << endl;
+    for (int ranks = 1; ranks <= max_ranks; ranks *= 2) {
+        if (!row(400 * ranks, ranks, stepped, wait, overlapped)) return 1;
+        if (ranks == 1) base = overlapped;
+        printf("  %5d  %5dx400  %10.1f  %8.1f%%  %12.1f  %9.0f%%\n", ranks, 400 * ranks, stepped, 100.0 * wait, overlapped,
+               100.0 * overlapped / (base * ranks));
+    }
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    bool headless = false;
+    int max_steps = 100000;
+    int check_interval = 100;
+    float tolerance = 1e-6f;
+    SimParams params;
+    string sweep_path, out_path = "sweep_results.csv";
+    string forces_path;
+    string probes_path;
+    string force_mask_path;
+    ProbeSet probes;
+    int num_lines = 0;
+    bool spectral_enabled = true;
+    vector<DerivedField> write_fields;
+    int field_every = 1000;
+    int num_tracers = 0;
+    string trajectories_path;
+    int trajectory_every = 10;
+    int trajectory_stride = 100;
+    GeometryOptions geometry_options;
+    BodyMotion motion;
+    vector<array<float, 5>> ib_filaments;   // x, y, length, amplitude, period
+    vector<array<float, 3>> ib_circles;     // x, y, radius
+    int ib_passes = 3;
+    int bench_ib = 0;
+    bool bench_collision = false;
+    unsigned num_threads = thread::hardware_concurrency();
+    int lanes = 0;
+    int bench_lanes = 0;
+    int refine_levels = 0;
+    float refine_margin = -1.0f;
+    int block_size = 20;
+    int amr_interval = 0;
+    float amr_threshold = 0.005f;
+    int domain_width = NX, domain_height = NY;
+    int ranks = 0;
+    int rank = 0;
+    string job = "opencfd";
+    int bench_ranks = 0;
+    
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--headless")) headless = true;
+        else if (!strcmp(argv[i], "--u-in") && i + 1 < argc) params.u_in = (float)atof(argv[++i]);
+        else if (!strcmp(argv[i], "--re") && i + 1 < argc) params.Re = (float)atof(argv[++i]);
+        else if (!strcmp(argv[i], "--radius") && i + 1 < argc) params.radius = (float)atof(argv[++i]);
+        else if (!strcmp(argv[i], "--sweep") && i + 1 < argc) sweep_path = argv[++i];
+        else if (!strcmp(argv[i], "--forces") && i + 1 < argc) forces_path = argv[++i];
+        else if (!strcmp(argv[i], "--probes-out") && i + 1 < argc) probes_path = argv[++i];
+        else if (!strcmp(argv[i], "--no-spectral")) spectral_enabled = false;
+        else if (!strcmp(argv[i], "--geometry") && i + 1 < argc) geometry_options.path = argv[++i];
+        else if (!strcmp(argv[i], "--geometry-scale") && i + 1 < argc) geometry_options.scale = (float)atof(argv[++i]);
+        else if (!strcmp(argv[i], "--geometry-flip-y")) geometry_options.flip_y = true;
+        else if (!strcmp(argv[i], "--geometry-dark")) geometry_options.solid_is_dark = true;
+        else if (!strcmp(argv[i], "--geometry-offset") && i + 1 < argc) {
+            if (sscanf(argv[++i], "%f,%f", &geometry_options.offset_x, &geometry_options.offset_y) != 2) {
+                cout << "--geometry-offset expects X,Y" << endl;
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "--rotate") && i + 1 < argc) motion.spin = (float)atof(argv[++i]);
+        else if (!strcmp(argv[i], "--oscillate") && i + 1 < argc) {
+            if (sscanf(argv[++i], "%f,%d", &motion.amplitude, &motion.period) != 2 || motion.period <= 0) {
+                cout << "--oscillate expects AMPLITUDE,PERIOD (cells, steps)" << endl;
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "--ib-filament") && i + 1 < argc) {
+            array<float, 5> v;
+            if (sscanf(argv[++i], "%f,%f,%f,%f,%f", &v[0], &v[1], &v[2], &v[3], &v[4]) != 5 || v[2] <= 0.0f) {
+                cout << "--ib-filament expects X,Y,LENGTH,AMPLITUDE,PERIOD" << endl;
+                return 1;
+            }
+            ib_filaments.push_back(v);
+        }
+        else if (!strcmp(argv[i], "--ib-circle") && i + 1 < argc) {
+            array<float, 3> v;
+            if (sscanf(argv[++i], "%f,%f,%f", &v[0], &v[1], &v[2]) != 3 || v[2] <= 0.0f) {
+                cout << "--ib-circle expects X,Y,R" << endl;
+                return 1;
+            }
+            ib_circles.push_back(v);
+        }
+        else if (!strcmp(argv[i], "--ib-passes") && i + 1 < argc) ib_passes = max(1, atoi(argv[++i]));
+        else if (!strcmp(argv[i], "--bench-ib") && i + 1 < argc) bench_ib = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--bench-collision")) bench_collision = true;
+        else if (!strcmp(argv[i], "--refine") && i + 1 < argc) refine_levels = max(0, atoi(argv[++i]));
+        else if (!strcmp(argv[i], "--refine-margin") && i + 1 < argc) refine_margin = (float)atof(argv[++i]);
+        else if (!strcmp(argv[i], "--block-size") && i + 1 < argc) block_size = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--amr-interval") && i + 1 < argc) amr_interval = max(0, atoi(argv[++i]));
+        else if (!strcmp(argv[i], "--amr-threshold") && i + 1 < argc) amr_threshold = (float)atof(argv[++i]);
+        else if (!strcmp(argv[i], "--domain") && i + 1 < argc) {
+            if (sscanf(argv[++i], "%dx%d", &domain_width, &domain_height) != 2 || domain_width <= 0 || domain_height <= 0) {
+                cout << "--domain expects WIDTHxHEIGHT" << endl;
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "--ranks") && i + 1 < argc) ranks = max(0, atoi(argv[++i]));
+        else if (!strcmp(argv[i], "--rank") && i + 1 < argc) rank = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--job") && i + 1 < argc) job = argv[++i];
+        else if (!strcmp(argv[i], "--bench-decomposition") && i + 1 < argc) bench_ranks = max(1, atoi(argv[++i]));
+        else if (!strcmp(argv[i], "--inlet") && i + 1 < argc) {
+            if (!ParseInletType(argv[++i], params.inlet)) {
+                cout << "--inlet takes equilibrium or zouhe" << endl;
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "--outlet") && i + 1 < argc) {
+            if (!ParseOutletType(argv[++i], params.outlet)) {
+                cout << "--outlet takes copy, pressure or convective" << endl;
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "--sponge") && i + 1 < argc) params.sponge = max(0, atoi(argv[++i]));
+        else if (!strcmp(argv[i], "--sponge-strength") && i + 1 < argc) params.sponge_strength = (float)atof(argv[++i]);
+        else if (!strcmp(argv[i], "--sponge-profile") && i + 1 < argc) {
+            if (!ParseSpongeProfile(argv[++i], params.sponge_profile)) {
+                cout << "--sponge-profile takes linear, quadratic, cubic or cosine" << endl;
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "--collision") && i + 1 < argc) {
+            if (!ParseCollisionType(argv[++i], params.collision)) {
+                cout << "--collision takes bgk, trt, mrt or central" << endl;
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "--limiter")) params.limiter = true;
+        else if (!strcmp(argv[i], "--channel")) params.channel = true;
+        else if (!strcmp(argv[i], "--force") && i + 1 < argc) {
+            if (sscanf(argv[++i], "%f,%f", &params.force_x, &params.force_y) != 2) {
+                cout << "--force expects FX,FY" << endl;
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "--force-mask") && i + 1 < argc) force_mask_path = argv[++i];
+        else if (!strcmp(argv[i], "--smagorinsky") && i + 1 < argc) params.smagorinsky = max(0.0f, (float)atof(argv[++i]));
+        else if (!strcmp(argv[i], "--tracers") && i + 1 < argc) num_tracers = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--trajectories") && i + 1 < argc) trajectories_path = argv[++i];
+        else if (!strcmp(argv[i], "--trajectory-every") && i + 1 < argc) trajectory_every = max(1, atoi(argv[++i]));
+        else if (!strcmp(argv[i], "--trajectory-stride") && i + 1 < argc) trajectory_stride = max(1, atoi(argv[++i]));
+        else if (!strcmp(argv[i], "--write-every") && i + 1 < argc) field_every = max(1, atoi(argv[++i]));
+        else if (!strcmp(argv[i], "--write-field") && i + 1 < argc) {
+            stringstream names(argv[++i]);
+            string name;
+            while (getline(names, name, ',')) {
+                DerivedField field;
+                if (!ParseDerivedField(name, field)) {
+                    cout << "Unknown field '" << name << "' (speed, vorticity, pressure, qcriterion, strainrate, eddyviscosity)" << endl;
+                    return 1;
+                }
+                write_fields.push_back(field);
+            }
+        }
+        else if (!strcmp(argv[i], "--probe") && i + 1 < argc) {
+            float x, y;
+            if (sscanf(argv[++i], "%f,%f", &x, &y) != 2) {
+                cout << "--probe expects X,Y" << endl;
+                return 1;
+            }
+            probes.Add("probe" + to_string(probes.Size()), x, y);
+        }
+        else if (!strcmp(argv[i], "--line") && i + 1 < argc) {
+            float x0, y0, x1, y1;
+            int n;
+            if (sscanf(argv[++i], "%f,%f,%f,%f,%d", &x0, &y0, &x1, &y1, &n) != 5 || n < 1) {
+                cout << "--line expects X0,Y0,X1,Y1,N" << endl;
+                return 1;
+            }
+            probes.AddLine("line" + to_string(num_lines++), x0, y0, x1, y1, n);
+        }
+        else if (!strcmp(argv[i], "--out") && i + 1 < argc) out_path = argv[++i];
+        else if (!strcmp(argv[i], "--threads") && i + 1 < argc) num_threads = (unsigned)atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--ensemble") && i + 1 < argc) lanes = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--bench-ensemble") && i + 1 < argc) bench_lanes = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--steps") && i + 1 < argc) max_steps = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--tol") && i + 1 < argc) tolerance = (float)atof(argv[++i]);
+        else if (!strcmp(argv[i], "--check-every") && i + 1 < argc) check_interval = atoi(argv[++i]);
+        else {
+            cout << "Unknown argument: " << argv[i] << endl;
+            cout << "Usage: OpenCFD [--headless] [--steps N] [--tol T] [--check-every N]" << endl;
+            cout << "               [--u-in U] [--re RE] [--radius R] [--forces FORCES.csv]" << endl;
+            cout << "               [--collision bgk|trt|mrt|central] [--smagorinsky CS] [--limiter] [--inlet equilibrium|zouhe] [--outlet copy|pressure|convective]" << endl;
+            cout << "               [--sponge CELLS] [--sponge-strength S] [--sponge-profile linear|quadratic|cubic|cosine]" << endl;
+            cout << "               [--channel] [--force FX,FY] [--force-mask MASK.pgm]" << endl;
+            cout << "               [--probe X,Y]... [--line X0,Y0,X1,Y1,N]... [--probes-out PROBES.csv]" << endl;
+            cout << "               [--no-spectral] [--write-field NAME[,NAME...]] [--write-every N]" << endl;
+            cout << "               [--geometry FILE] [--geometry-scale S] [--geometry-offset X,Y]" << endl;
+            cout << "               [--geometry-flip-y] [--geometry-dark] [--oscillate A,PERIOD] [--rotate RATE]" << endl;
+            cout << "               [--ib-filament X,Y,LENGTH,AMPLITUDE,PERIOD]... [--ib-circle X,Y,R]... [--ib-passes N]" << endl;
+            cout << "               [--tracers N] [--trajectories FILE.csv] [--trajectory-every N] [--trajectory-stride N]" << endl;
+            cout << "               [--sweep SPEC] [--out RESULTS.csv] [--threads N] [--ensemble 8|16]" << endl;
+            cout << "               [--bench-ensemble 8|16] [--bench-ib MARKERS] [--bench-collision]" << endl;
+            cout << "               [--refine LEVELS] [--refine-margin CELLS] [--block-size B]" << endl;
+            cout << "               [--amr-interval STEPS] [--amr-threshold VORTICITY]" << endl;
+            cout << "               [--ranks N --rank R] [--job NAME] [--domain WxH] [--bench-decomposition MAX_RANKS]" << endl;
+            return 1;
+        }
+    }
+    
+    if (lanes != 0 && lanes != 8 && lanes != 16) {
+        cout << "--ensemble takes 8 or 16 lanes" << endl;
+        return 1;
+    }
+    if (bench_lanes == 8) return BenchEnsemble<8>(200);
+    if (bench_lanes == 16) return BenchEnsemble<16>(200);
+    if (bench_ib > 0) return BenchImmersed(bench_ib, num_threads, 200);
+    if (bench_collision) return BenchCollision(200);
+    if (bench_ranks > 0) return BenchDecomposition(bench_ranks, 200);
+    if (ranks > 0) return RunDistributed(params, domain_width, domain_height, block_size, rank, ranks, job, max_steps, num_threads);
+    if (refine_levels > 0) {
+        return RunRefined(params, refine_levels, refine_margin >= 0.0f ? refine_margin : params.radius, block_size,
+                           amr_interval, amr_threshold, max_steps, num_threads);
+    }
+    
+    shared_ptr<const Geometry> geometry;
+    if (!geometry_options.path.empty()) {
+        WorkStealingPool raster_pool(num_threads);
+        auto start = chrono::steady_clock::now();
+        geometry = LoadGeometry(geometry_options, raster_pool);
+        if (!geometry) return 1;
+        double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+        if (geometry->num_obstacles == 0) {
+            cout << "Geometry " << geometry_options.path << " has no solid cells" << endl;
+            return 1;
+        }
+        cout << "Geometry " << geometry_options.path << ": " << geometry->num_obstacles << " obstacle(s), "
+             << geometry->links.size() << " boundary links, frontal height " << 2.0f * geometry->radius
+             << " cells (" << ms << " ms)" << endl;
+        params.radius = geometry->radius; // Re, Cd and St refer to the body's frontal height
+    }
+    
+    if (!sweep_path.empty()) {
+        SweepSpec spec;
+        spec.inlet = params.inlet;      // Command-line edges, unless the spec sets its own
+        spec.outlet = params.outlet;
+        spec.sponge = params.sponge;
+        spec.sponge_strength = params.sponge_strength;
+        spec.sponge_profile = params.sponge_profile;
+        spec.collision = params.collision;
+        spec.smagorinsky = params.smagorinsky;
+        spec.limiter = params.limiter;
+        spec.channel = params.channel;
+        spec.force_x = params.force_x;
+        spec.force_y = params.force_y;
+        if (!spec.Load(sweep_path)) return 1;
+        return RunSweep(spec, out_path, num_threads, lanes, geometry);
+    }
+    
+    // A moving body keeps its own copy of the geometry and updates it every step
+    unique_ptr<MovingBody> body;
+    if (motion.Moves()) {
+        if (params.channel) {
+            cout << "Moving bodies cannot be combined with --channel" << endl;
+            return 1;
+        }
+        if (!geometry) geometry = Geometry::Cylinder(params.radius);
+        if (!MovingBody::Supports(*geometry)) {
+            cout << "Moving bodies need a cylinder or polygon geometry, not a bitmap mask" << endl;
+            return 1;
+        }
+        body = make_unique<MovingBody>(*geometry, motion);
+        geometry = body->GetGeometry();
+    }
+    
+    FastAirLBM sim(params, geometry);
+    sim.SetMovingBody(body.get());
+    
+    // Spatially varying body force: the uniform force scaled by the mask brightness
+    if (!force_mask_path.empty()) {
+        vector<unsigned char> mask;
+        int width = 0, height = 0;
+        if (!LoadPGM(force_mask_path, mask, width, height)) return 1;
+        float fx, fy;
+        params.BodyForce(fx, fy);
+        vector<float> field_x(NX * NY), field_y(NX * NY);
+        for (int y = 0; y < NY; y++) {
+            for (int x = 0; x < NX; x++) {
+                float scale = mask[(size_t)min(height - 1, y * height / NY) * width + min(width - 1, x * width / NX)] / 255.0f;
+                field_x[idx(x, y)] = fx * scale;
+                field_y[idx(x, y)] = fy * scale;
+            }
+        }
+        sim.SetForceField(move(field_x), move(field_y));
+    }
+    
+    // Immersed-boundary bodies share one pool for interpolation and spreading
+    unique_ptr<WorkStealingPool> ib_pool;
+    unique_ptr<ImmersedBoundary> ib;
+    if (!ib_filaments.empty() || !ib_circles.empty()) {
+        ib_pool = make_unique<WorkStealingPool>(num_threads);
+        ib = make_unique<ImmersedBoundary>(*ib_pool, ib_passes);
+        for (const auto& v : ib_filaments) ib->AddFilament(v[0], v[1], v[2], v[3], (int)v[4]);
+        for (const auto& v : ib_circles) ib->AddCircle(v[0], v[1], v[2]);
+        sim.SetImmersedBoundary(ib.get());
+        cout << "Immersed boundary: " << ib->Size() << " markers" << endl;
+    }
+    sim.SetConvergence(body ? 0 : check_interval, tolerance);
+    sim.Initialize();
+    
+    // Default probes: a short line across the upper wake of the body
+    if (probes.Empty()) {
+        const Geometry& g = sim.GetGeometry();
+        probes.AddLine("wake", g.cx + 2.0f * g.radius, g.cy + 0.5f * g.radius,
+                       g.cx + 10.0f * g.radius, g.cy + 0.5f * g.radius, 5);
+    }
+    
+    unique_ptr<ProbeWriter> probe_writer;
+    if (!probes_path.empty()) {
+        probe_writer = make_unique<ProbeWriter>(probes, probes_path);
+        if (!probe_writer->IsOpen()) {
+            cout << "Cannot write probe samples: " << probes_path << endl;
+            return 1;
+        }
+    }
+    
+    // Shedding frequency from the probe uy signals, referenced to the cylinder diameter
+    unique_ptr<StrouhalAnalyzer> spectral;
+    if (spectral_enabled) {
+        spectral = make_unique<StrouhalAnalyzer>(probes, 2.0f * params.radius, params.u_in);
+    }
+    
+    // Tracer particles share one pool for their parallel advection
+    unique_ptr<WorkStealingPool> tracer_pool;
+    unique_ptr<TracerSet> tracers;
+    if (num_tracers > 0) {
+        tracer_pool = make_unique<WorkStealingPool>(num_threads);
+        tracers = make_unique<TracerSet>(*tracer_pool);
+        tracers->Seed(num_tracers, sim.GetGeometry().obstacle);
+        sim.SetTracers(tracers.get());
+    }
+    
+    probes.Start();
+    if (probe_writer) probe_writer->Start();
+    if (spectral) spectral->Start();
+    sim.SetProbes(&probes);
+    
+    if (headless) {
+        HeadlessOutputs outputs;
+        outputs.forces_path = forces_path;
+        outputs.spectral = spectral.get();
+        outputs.fields = write_fields;
+        outputs.field_every = field_every;
+        outputs.tracers = tracers.get();
+        outputs.trajectories_path = trajectories_path;
+        outputs.trajectory_every = trajectory_every;
+        outputs.trajectory_stride = trajectory_stride;
+        int status = RunHeadless(sim, max_steps, outputs);
+        if (spectral) spectral->Stop();
+        if (probe_writer) probe_writer->Stop();
+        return status;
+    }
+    
+    InitWindow(NX*2, NY*2, "Fast Air LBM CFD - High Speed Low Viscosity");
+    SetTargetFPS(60);
+    sim.InitTexture();
     
     cout << "FAST-MOVING AIR CFD running!" << endl;
     cout << "Air moves very freely with high speed and low viscosity!" << endl;
     
+    StepScheduler& scheduler = sim.GetScheduler();
+    DerivedField shown_field = DerivedField::Speed;
+    bool divergence_reported = false;
+    float brush = 4.0f;                 // Obstacle paint brush radius in cells
+    
     while (!WindowShouldClose()) {
+        // T toggles max-throughput mode, [ and ] change how often it renders
+        if (IsKeyPressed(KEY_T)) {
+            scheduler.SetMaxThroughput(!scheduler.IsMaxThroughput());
+            SetTargetFPS(scheduler.IsMaxThroughput() ? 0 : 60);
+        }
+        if (IsKeyPressed(KEY_RIGHT_BRACKET)) scheduler.SetRenderInterval(scheduler.GetRenderInterval() * 2);
+        if (IsKeyPressed(KEY_LEFT_BRACKET)) scheduler.SetRenderInterval(scheduler.GetRenderInterval() / 2);
+        
+        // 1-6 pick the displayed field: speed, vorticity, pressure, Q-criterion, strain rate, eddy viscosity
+        for (int i = 0; i < (int)DerivedField::Count; i++) {
+            if (IsKeyPressed(KEY_ONE + i)) shown_field = (DerivedField)i;
+        }
+        
+        // Left mouse paints obstacles, right mouse erases, the wheel sets the brush size
+        brush = max(1.0f, min(40.0f, brush + GetMouseWheelMove()));
+        bool painting = IsMouseButtonDown(MOUSE_BUTTON_LEFT);
+        if (painting || IsMouseButtonDown(MOUSE_BUTTON_RIGHT)) {
+            Vector2 mouse = GetMousePosition();
+            sim.PaintObstacle(mouse.x / 2.0f, mouse.y / 2.0f, brush, painting);
+        }
+        
         sim.Update();
-        sim.Render();
+        if (sim.HasDiverged() && !divergence_reported) {
+            sim.ReportDivergence(cout);
+            divergence_reported = true;
+        }
+        
+        double render_start = GetTime();
+        sim.Render(shown_field);
         
         BeginDrawing();
         ClearBackground(BLACK);
         
         // Draw simulation
         DrawTextureEx(sim.GetTexture(), {0, 0}, 0.0f, 2.0f, WHITE);
+        for (int i = 0; i < probes.Size(); i++) {
+            DrawCircleLines((int)(probes.Get(i).x * 2.0f), (int)(probes.Get(i).y * 2.0f), 3.0f, MAGENTA);
+        }
+        if (ib) {
+            for (size_t m = 0; m < ib->Size(); m++) DrawPixel((int)(ib->X(m) * 2.0f), (int)(ib->Y(m) * 2.0f), WHITE);
+        }
         
         // Enhanced info display
         DrawFPS(10, 10);
@@ -378,11 +1922,46 @@ int main() {
         DrawText(TextFormat("Max Speed: %.3f", sim.GetMaxSpeed()), 10, 70, 16, YELLOW);
         DrawText(TextFormat("Inlet: %.3f", sim.GetInletSpeed()), 10, 90, 16, YELLOW);
         DrawText(TextFormat("Reynolds: %.0f", sim.GetReynolds()), 10, 110, 16, CYAN);
-        DrawText("Dark Blue=Slow, Red=Very Fast", 10, 130, 14, WHITE);
+        if (shown_field == DerivedField::Speed || shown_field == DerivedField::StrainRate ||
+            shown_field == DerivedField::EddyViscosity) {
+            DrawText(TextFormat("Field: %s (1-6)  Dark Blue=Low, Red=High", DerivedFieldName(shown_field)), 10, 130, 14, WHITE);
+        } else {
+            DrawText(TextFormat("Field: %s (1-6)  Blue=Negative, Red=Positive", DerivedFieldName(shown_field)), 10, 130, 14, WHITE);
+        }
+        DrawText(TextFormat("Step: %d  Steps/frame: %d  (%.0f steps/s)", sim.GetTimeStep(),
+                            scheduler.GetLastSteps(), scheduler.GetStepsPerSecond()), 10, 150, 14, WHITE);
+        DrawText(TextFormat("Residual: %.2e", sim.GetResidual()), 10, 168, 14, sim.IsConverged() ? GREEN : LIGHTGRAY);
+        if (sim.GetObstacleCount() > 0) {
+            DrawText(TextFormat("Cd: %.3f  Cl: %+.3f", sim.GetDragCoefficient(0), sim.GetLiftCoefficient(0)), 10, 186, 14, CYAN);
+        }
+        if (ib) {
+            DrawText(TextFormat("IB Cd: %.3f  Cl: %+.3f", sim.GetImmersedDragCoefficient(), sim.GetImmersedLiftCoefficient()),
+                     200, 186, 14, CYAN);
+        }
+        if (spectral && spectral->GetResult().valid) {
+            StrouhalAnalyzer::Result st = spectral->GetResult();
+            DrawText(TextFormat("St: %.3f  (f = %.2e, %.2e, %.2e /step)", st.strouhal, st.peaks[0], st.peaks[1], st.peaks[2]),
+                     10, 204, 14, CYAN);
+        }
+        if (scheduler.IsMaxThroughput()) {
+            DrawText(TextFormat("MAX THROUGHPUT: render every %d steps", scheduler.GetRenderInterval()), 10, 222, 14, ORANGE);
+        }
+        if (sim.IsConverged()) {
+            DrawText("CONVERGED - steady state reached", 10, 240, 16, GREEN);
+        }
+        if (sim.HasDiverged()) {
+            DrawText("DIVERGED - halted, see console for the first bad cell", 10, 240, 16, RED);
+        }
+        DrawText(TextFormat("Mouse: left paints, right erases, wheel = brush (%.0f)", brush), 10, 258, 14, LIGHTGRAY);
         
+        // Sampled before EndDrawing: at 60 FPS it sleeps out the rest of the frame, and
+        // counting that wait would shrink the next budget to the last frame's step time
+        scheduler.RecordOverhead(GetTime() - render_start);
         EndDrawing();
     }
     
+    if (spectral) spectral->Stop();
+    if (probe_writer) probe_writer->Stop();
     sim.Cleanup();
     CloseWindow();
     
@@ -0,0 +1,215 @@
+﻿/**
+ * @file Probes.h
+ * @brief Point probes and line samplers with ring-buffer capture
+ *
+ * Probes are registered once, with their bilinear stencil precomputed. Each step
+ * the solver samples ux, uy and pressure (rho/3) at every probe into one frame of
+ * a preallocated ring buffer, so the cost is proportional to the number of probes.
+ * A writer thread drains the ring in batches and appends CSV rows to disk.
+ */
+
+#pragma once
+
+#include "Lattice.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Preallocated ring of fixed-size float frames with one producer and up to
+// MaxReaders independent reader cursors. The producer never allocates; it only
+// waits if the slowest reader falls a whole ring behind.
+class SampleRing {
+public:
+    static const int MaxReaders = 4;
+
+private:
+    std::vector<float> data;    // capacity * stride
+    std::vector<int> steps;     // Time step of each frame
+    int stride;
+    int capacity;
+    int num_readers;
+    std::atomic<uint64_t> head;             // Frames published
+    std::atomic<uint64_t> tails[MaxReaders]; // Frames consumed per reader
+
+    uint64_t SlowestTail() const {
+        uint64_t slowest = head.load(std::memory_order_relaxed);
+        for (int r = 0; r < num_readers; r++) {
+            slowest = std::min(slowest, tails[r].load(std::memory_order_acquire));
+        }
+        return slowest;
+    }
+
+public:
+    SampleRing() : stride(0), capacity(0), num_readers(0), head(0) {
+        for (auto& t : tails) t.store(0);
+    }
+
+    void Reset(int frame_size, int frames) {
+        stride = frame_size;
+        capacity = frames;
+        data.assign((size_t)stride * capacity, 0.0f);
+        steps.assign(capacity, 0);
+        head.store(0);
+        for (auto& t : tails) t.store(0);
+    }
+
+    // Registers a reader; must happen before the first frame is written
+    int AddReader() { return num_readers < MaxReaders ? num_readers++ : -1; }
+
+    // Producer side: fill the returned frame, then Publish()
+    float* BeginWrite(int step) {
+        uint64_t h = head.load(std::memory_order_relaxed);
+        while (h - SlowestTail() >= (uint64_t)capacity) {
+            std::this_thread::yield();
+        }
+        steps[h % capacity] = step;
+        return &data[(h % capacity) * stride];
+    }
+    void Publish() { head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+    // Reader side: frames [Tail(r), Head()) are readable until Consume()
+    uint64_t Head() const { return head.load(std::memory_order_acquire); }
+    uint64_t Tail(int reader) const { return tails[reader].load(std::memory_order_relaxed); }
+    const float* Frame(uint64_t i) const { return &data[(i % capacity) * stride]; }
+    int Step(uint64_t i) const { return steps[i % capacity]; }
+    void Consume(int reader, uint64_t up_to) { tails[reader].store(up_to, std::memory_order_release); }
+
+    int Stride() const { return stride; }
+    int Capacity() const { return capacity; }
+};
+
+// Registered sample points. Frame layout: [ux, uy, p] per probe.
+class ProbeSet {
+public:
+    static const int Channels = 3;
+
+    struct Probe {
+        std::string name;
+        float x, y;
+        int id[4];      // Bilinear stencil cells
+        float wt[4];    // and their weights
+    };
+
+private:
+    std::vector<Probe> probes;
+    SampleRing ring;
+
+public:
+    // Adds a point probe at (x, y) in cell units; returns its index
+    int Add(const std::string& name, float x, float y) {
+        x = std::clamp(x, 0.0f, (float)(NX - 1));
+        y = std::clamp(y, 0.0f, (float)(NY - 1));
+        int x0 = std::min((int)x, NX - 2);
+        int y0 = std::min((int)y, NY - 2);
+        float tx = x - x0;
+        float ty = y - y0;
+
+        Probe p;
+        p.name = name;
+        p.x = x;
+        p.y = y;
+        p.id[0] = idx(x0, y0);
+        p.id[1] = idx(x0 + 1, y0);
+        p.id[2] = idx(x0, y0 + 1);
+        p.id[3] = idx(x0 + 1, y0 + 1);
+        p.wt[0] = (1 - tx) * (1 - ty);
+        p.wt[1] = tx * (1 - ty);
+        p.wt[2] = (1 - tx) * ty;
+        p.wt[3] = tx * ty;
+        probes.push_back(p);
+        return (int)probes.size() - 1;
+    }
+
+    // Adds n equally spaced probes from (x0, y0) to (x1, y1), named name[i]
+    void AddLine(const std::string& name, float x0, float y0, float x1, float y1, int n) {
+        for (int i = 0; i < n; i++) {
+            float t = n > 1 ? (float)i / (n - 1) : 0.0f;
+            Add(name + "[" + std::to_string(i) + "]", x0 + t * (x1 - x0), y0 + t * (y1 - y0));
+        }
+    }
+
+    // Allocates the ring; call after all probes and readers are known
+    void Start(int frames = 4096) { ring.Reset((int)probes.size() * Channels, frames); }
+
+    // Called by the solver once per step with its current macroscopic fields
+    void Sample(int step, const float* rho, const float* ux, const float* uy) {
+        if (probes.empty()) return;
+        float* frame = ring.BeginWrite(step);
+        for (const Probe& p : probes) {
+            float u = 0.0f, v = 0.0f, r = 0.0f;
+            for (int i = 0; i < 4; i++) {
+                u += p.wt[i] * ux[p.id[i]];
+                v += p.wt[i] * uy[p.id[i]];
+                r += p.wt[i] * rho[p.id[i]];
+            }
+            *frame++ = u;
+            *frame++ = v;
+            *frame++ = r / 3.0f; // Lattice pressure p = cs^2 rho
+        }
+        ring.Publish();
+    }
+
+    bool Empty() const { return probes.empty(); }
+    int Size() const { return (int)probes.size(); }
+    const Probe& Get(int i) const { return probes[i]; }
+    SampleRing& Ring() { return ring; }
+};
+
+// Background thread that drains a ProbeSet ring and writes CSV rows
+// (step,probe,ux,uy,p) in batches
+class ProbeWriter {
+private:
+    ProbeSet& probes;
+    std::ofstream out;
+    std::thread worker;
+    std::atomic<bool> stopping;
+    int reader;
+
+    void Drain() {
+        SampleRing& ring = probes.Ring();
+        uint64_t tail = ring.Tail(reader);
+        uint64_t head = ring.Head();
+        for (uint64_t i = tail; i < head; i++) {
+            const float* frame = ring.Frame(i);
+            for (int p = 0; p < probes.Size(); p++) {
+                out << ring.Step(i) << "," << probes.Get(p).name << "," << frame[p * 3] << ","
+                    << frame[p * 3 + 1] << "," << frame[p * 3 + 2] << "\n";
+            }
+        }
+        ring.Consume(reader, head);
+        if (head != tail) out.flush();
+    }
+
+public:
+    // Registers as a ring reader; start the thread after ProbeSet::Start()
+    ProbeWriter(ProbeSet& set, const std::string& path) : probes(set), out(path), stopping(false) {
+        reader = probes.Ring().AddReader();
+        out << "step,probe,ux,uy,p\n";
+    }
+
+    ~ProbeWriter() { Stop(); }
+
+    bool IsOpen() const { return (bool)out; }
+
+    void Start() {
+        worker = std::thread([this] {
+            while (!stopping.load()) {
+                Drain();
+                std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            }
+            Drain();
+        });
+    }
+
+    // Writes out whatever is left in the ring and joins the thread
+    void Stop() {
+        if (!worker.joinable()) return;
+        stopping.store(true);
+        worker.join();
+    }
+};
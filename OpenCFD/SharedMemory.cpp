@@ -0,0 +1,112 @@
+﻿/**
+ * @file SharedMemory.cpp
+ * @brief SharedSegment on Win32 file mappings and POSIX shm_open
+ */
+
+#include "SharedMemory.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+
+// Windows removes a mapping when its last handle closes, so there is nothing stale
+bool SharedSegment::Create(const std::string& name, size_t bytes) {
+    Close();
+    std::string path = "Local\\" + name;
+    HANDLE mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+                                        (DWORD)((unsigned long long)bytes >> 32), (DWORD)(bytes & 0xffffffffu), path.c_str());
+    if (!mapping) return false;
+    if (GetLastError() == ERROR_ALREADY_EXISTS) {
+        CloseHandle(mapping);
+        return false;
+    }
+    data = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, bytes);
+    if (!data) {
+        CloseHandle(mapping);
+        return false;
+    }
+    handle = mapping;
+    size = bytes;
+    return true;
+}
+
+bool SharedSegment::Open(const std::string& name, size_t bytes) {
+    Close();
+    std::string path = "Local\\" + name;
+    HANDLE mapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, path.c_str());
+    if (!mapping) return false;
+    data = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, bytes);
+    if (!data) {
+        CloseHandle(mapping);
+        return false;
+    }
+    handle = mapping;
+    size = bytes;
+    return true;
+}
+
+void SharedSegment::Close() {
+    if (data) UnmapViewOfFile(data);
+    if (handle) CloseHandle((HANDLE)handle);
+    data = nullptr;
+    handle = nullptr;
+    size = 0;
+}
+
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+bool SharedSegment::Create(const std::string& name, size_t bytes) {
+    Close();
+    std::string path = "/" + name;
+    shm_unlink(path.c_str());
+    int fd = shm_open(path.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0) return false;
+    if (ftruncate(fd, (off_t)bytes) != 0) {
+        close(fd);
+        shm_unlink(path.c_str());
+        return false;
+    }
+    void* mapped = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        shm_unlink(path.c_str());
+        return false;
+    }
+    data = mapped;
+    size = bytes;
+    created = path;
+    return true;
+}
+
+bool SharedSegment::Open(const std::string& name, size_t bytes) {
+    Close();
+    std::string path = "/" + name;
+    int fd = shm_open(path.c_str(), O_RDWR, 0600);
+    if (fd < 0) return false;
+    // The creator may not have sized it yet; touching past the end would fault
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < bytes) {
+        close(fd);
+        return false;
+    }
+    void* mapped = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) return false;
+    data = mapped;
+    size = bytes;
+    return true;
+}
+
+void SharedSegment::Close() {
+    if (data) munmap(data, size);
+    if (!created.empty()) shm_unlink(created.c_str());
+    data = nullptr;
+    size = 0;
+    created.clear();
+}
+#endif
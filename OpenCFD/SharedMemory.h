@@ -0,0 +1,37 @@
+﻿/**
+ * @file SharedMemory.h
+ * @brief Named shared-memory segment that several processes can map
+ *
+ * The operating-system calls live in SharedMemory.cpp so that <windows.h> stays out
+ * of the translation unit that includes raylib (both declare CloseWindow, DrawText,
+ * Rectangle, ...). Segments are zero-filled when created.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+class SharedSegment {
+private:
+    void* data = nullptr;
+    size_t size = 0;
+    void* handle = nullptr;              // Windows mapping handle
+    std::string created;                 // Name to remove on close, creator only
+
+    void Close();
+
+public:
+    SharedSegment() = default;
+    ~SharedSegment() { Close(); }
+    SharedSegment(const SharedSegment&) = delete;
+    SharedSegment& operator=(const SharedSegment&) = delete;
+
+    // Creates `bytes` of zeros under `name`, replacing a stale segment of that name
+    bool Create(const std::string& name, size_t bytes);
+    // Maps a segment another process created; false until it exists at full size
+    bool Open(const std::string& name, size_t bytes);
+
+    void* Data() const { return data; }
+    size_t Size() const { return size; }
+};
@@ -0,0 +1,206 @@
+﻿/**
+ * @file Spectral.h
+ * @brief Online shedding-frequency (Strouhal number) estimation from probe signals
+ *
+ * Runs on its own thread as an extra reader of the probe ring buffer. The uy signal
+ * of every probe is decimated into a sliding window; every few hundred new samples
+ * the window is Hann-tapered and scanned with the Goertzel recurrence, first on the
+ * integer DFT bins and then on a fine grid around the strongest one. Spectra of all
+ * probes are summed so a single probe sitting on a node does not hide the peak.
+ */
+
+#pragma once
+
+#include "Probes.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class StrouhalAnalyzer {
+public:
+    static const int MaxPeaks = 3;
+
+    struct Result {
+        bool valid = false;
+        int step = 0;                 // Last time step included in the window
+        float frequency = 0.0f;       // Dominant frequency, cycles per time step
+        float strouhal = 0.0f;        // frequency * D / U
+        float peaks[MaxPeaks] = {};   // Strongest spectral peaks, cycles per time step
+    };
+
+private:
+    ProbeSet& probes;
+    float diameter;
+    float velocity;
+    int decimate;     // Keep one sample in `decimate` steps
+    int window;       // Samples per probe in the analysis window
+    int interval;     // New samples between analyses
+    float max_strouhal; // Upper end of the scanned band; keeps start-up acoustics out
+
+    int reader;
+    std::vector<std::vector<float>> history;  // Circular uy window per probe
+    int filled;
+    int write_pos;
+    int last_step;
+    uint64_t frames_seen;
+
+    std::thread worker;
+    std::atomic<bool> stopping;
+    std::mutex result_lock;
+    Result result;
+
+    // Power of the tapered, mean-free signal at `bin` cycles per window (need not be integer)
+    float Goertzel(const std::vector<float>& x, float bin) const {
+        int n = (int)x.size();
+        float coeff = 2.0f * std::cos(6.2831853f * bin / n);
+        float s1 = 0.0f, s2 = 0.0f;
+        for (int i = 0; i < n; i++) {
+            float s0 = x[i] + coeff * s1 - s2;
+            s2 = s1;
+            s1 = s0;
+        }
+        return s1*s1 + s2*s2 - coeff*s1*s2;
+    }
+
+    float SummedPower(const std::vector<std::vector<float>>& signals, float bin) const {
+        float power = 0.0f;
+        for (const auto& x : signals) power += Goertzel(x, bin);
+        return power;
+    }
+
+    void Analyze() {
+        int n = filled;
+        if (n < 64) return;
+
+        // Unroll each circular window oldest-first, remove the mean and taper it
+        std::vector<std::vector<float>> signals(history.size(), std::vector<float>(n));
+        int start = filled < window ? 0 : write_pos;
+        for (size_t p = 0; p < history.size(); p++) {
+            double mean = 0.0;
+            for (int i = 0; i < n; i++) {
+                signals[p][i] = history[p][(start + i) % window];
+                mean += signals[p][i];
+            }
+            mean /= n;
+            for (int i = 0; i < n; i++) {
+                float hann = 0.5f - 0.5f * std::cos(6.2831853f * i / (n - 1));
+                signals[p][i] = (float)(signals[p][i] - mean) * hann;
+            }
+        }
+
+        // Coarse scan over integer bins, skipping the lowest two (drift, start-up transient)
+        float max_frequency = max_strouhal * velocity / diameter;
+        int max_bin = std::min(n / 2 - 1, (int)(max_frequency * n * decimate) + 1);
+        if (max_bin < 4) return;
+        std::vector<float> spectrum(max_bin + 1, 0.0f);
+        for (int k = 2; k <= max_bin; k++) spectrum[k] = SummedPower(signals, (float)k);
+
+        // Strongest local maxima
+        float peak_bins[MaxPeaks] = {};
+        float peak_power[MaxPeaks] = {};
+        for (int k = 3; k < max_bin; k++) {
+            if (spectrum[k] < spectrum[k - 1] || spectrum[k] < spectrum[k + 1]) continue;
+            for (int j = 0; j < MaxPeaks; j++) {
+                if (spectrum[k] <= peak_power[j]) continue;
+                for (int m = MaxPeaks - 1; m > j; m--) {
+                    peak_bins[m] = peak_bins[m - 1];
+                    peak_power[m] = peak_power[m - 1];
+                }
+                peak_bins[j] = (float)k;
+                peak_power[j] = spectrum[k];
+                break;
+            }
+        }
+        if (peak_power[0] <= 0.0f) return;
+
+        // Refine the dominant peak on a 1/20-bin grid
+        float best_bin = peak_bins[0];
+        float best_power = peak_power[0];
+        for (float b = peak_bins[0] - 1.0f; b <= peak_bins[0] + 1.0f; b += 0.05f) {
+            float power = SummedPower(signals, b);
+            if (power > best_power) {
+                best_power = power;
+                best_bin = b;
+            }
+        }
+
+        float to_frequency = 1.0f / ((float)n * decimate); // Bins -> cycles per step
+        Result r;
+        r.valid = true;
+        r.step = last_step;
+        r.frequency = best_bin * to_frequency;
+        r.strouhal = r.frequency * diameter / velocity;
+        for (int j = 0; j < MaxPeaks; j++) r.peaks[j] = peak_bins[j] * to_frequency;
+        r.peaks[0] = r.frequency;
+
+        std::lock_guard<std::mutex> guard(result_lock);
+        result = r;
+    }
+
+    // Pulls new frames from the ring; returns the number of decimated samples added
+    int Drain() {
+        SampleRing& ring = probes.Ring();
+        uint64_t head = ring.Head();
+        int added = 0;
+        for (uint64_t i = ring.Tail(reader); i < head; i++, frames_seen++) {
+            if (frames_seen % decimate != 0) continue;
+            const float* frame = ring.Frame(i);
+            for (size_t p = 0; p < history.size(); p++) {
+                history[p][write_pos] = frame[p * ProbeSet::Channels + 1]; // uy
+            }
+            write_pos = (write_pos + 1) % window;
+            filled = std::min(filled + 1, window);
+            last_step = ring.Step(i);
+            added++;
+        }
+        ring.Consume(reader, head);
+        return added;
+    }
+
+public:
+    // Registers as a ring reader; start the thread after ProbeSet::Start()
+    StrouhalAnalyzer(ProbeSet& set, float reference_length, float reference_velocity,
+                     int decimation = 4, int window_samples = 2048, int analysis_interval = 256)
+        : probes(set), diameter(reference_length), velocity(reference_velocity),
+          decimate(std::max(1, decimation)), window(window_samples), interval(analysis_interval),
+          max_strouhal(1.0f),
+          filled(0), write_pos(0), last_step(0), frames_seen(0), stopping(false) {
+        reader = probes.Ring().AddReader();
+    }
+
+    ~StrouhalAnalyzer() { Stop(); }
+
+    void SetMaxStrouhal(float st) { max_strouhal = st; }
+
+    void Start() {
+        history.assign(probes.Size(), std::vector<float>(window, 0.0f));
+        worker = std::thread([this] {
+            int since_analysis = 0;
+            while (!stopping.load()) {
+                since_analysis += Drain();
+                if (since_analysis >= interval) {
+                    since_analysis = 0;
+                    Analyze();
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+        });
+    }
+
+    void Stop() {
+        if (!worker.joinable()) return;
+        stopping.store(true);
+        worker.join();
+        // Let the solver keep running without this reader holding the ring back
+        probes.Ring().Consume(reader, ~(uint64_t)0 >> 1);
+    }
+
+    Result GetResult() {
+        std::lock_guard<std::mutex> guard(result_lock);
+        return result;
+    }
+};
@@ -0,0 +1,137 @@
+﻿/**
+ * @file ThreadPool.h
+ * @brief Work-stealing thread pool for running independent jobs across cores
+ *
+ * Each worker owns a deque of tasks. Workers pop from the back of their own deque
+ * and, when it runs dry, steal from the front of the other workers' deques, so
+ * long-running jobs do not leave the remaining cores idle.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class WorkStealingPool {
+private:
+    struct Worker {
+        std::deque<std::function<void()>> tasks;
+        std::mutex lock;
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<std::thread> threads;
+
+    std::mutex wake_lock;
+    std::condition_variable wake;
+    std::condition_variable idle;
+    std::atomic<int> pending;   // Submitted but not yet finished
+    std::atomic<int> queued;    // Sitting in a deque, not yet picked up
+    std::atomic<unsigned> next_queue;
+    bool stopping;
+
+    bool PopLocal(unsigned self, std::function<void()>& task) {
+        Worker& w = *workers[self];
+        std::lock_guard<std::mutex> guard(w.lock);
+        if (w.tasks.empty()) return false;
+        task = std::move(w.tasks.back());
+        w.tasks.pop_back();
+        return true;
+    }
+
+    bool Steal(unsigned self, std::function<void()>& task) {
+        unsigned n = (unsigned)workers.size();
+        for (unsigned i = 1; i < n; i++) {
+            Worker& victim = *workers[(self + i) % n];
+            std::lock_guard<std::mutex> guard(victim.lock);
+            if (victim.tasks.empty()) continue;
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            return true;
+        }
+        return false;
+    }
+
+    void WorkerLoop(unsigned self) {
+        while (true) {
+            std::function<void()> task;
+            if (PopLocal(self, task) || Steal(self, task)) {
+                queued.fetch_sub(1);
+                task();
+                if (pending.fetch_sub(1) == 1) {
+                    std::lock_guard<std::mutex> guard(wake_lock);
+                    idle.notify_all();
+                }
+                continue;
+            }
+
+            std::unique_lock<std::mutex> guard(wake_lock);
+            wake.wait(guard, [this] { return stopping || queued.load() > 0; });
+            if (stopping && queued.load() == 0) return;
+        }
+    }
+
+public:
+    explicit WorkStealingPool(unsigned num_threads = std::thread::hardware_concurrency())
+        : pending(0), queued(0), next_queue(0), stopping(false) {
+        if (num_threads == 0) num_threads = 1;
+        for (unsigned i = 0; i < num_threads; i++) {
+            workers.push_back(std::make_unique<Worker>());
+        }
+        for (unsigned i = 0; i < num_threads; i++) {
+            threads.emplace_back([this, i] { WorkerLoop(i); });
+        }
+    }
+
+    ~WorkStealingPool() {
+        {
+            std::lock_guard<std::mutex> guard(wake_lock);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& t : threads) t.join();
+    }
+
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    // Queues a task on the next worker in round-robin order
+    void Submit(std::function<void()> task) {
+        pending.fetch_add(1);
+        unsigned q = next_queue.fetch_add(1) % (unsigned)workers.size();
+        {
+            std::lock_guard<std::mutex> guard(workers[q]->lock);
+            workers[q]->tasks.push_back(std::move(task));
+        }
+        {
+            std::lock_guard<std::mutex> guard(wake_lock);
+            queued.fetch_add(1);
+        }
+        wake.notify_one();
+    }
+
+    // Blocks until every submitted task has finished
+    void Wait() {
+        std::unique_lock<std::mutex> guard(wake_lock);
+        idle.wait(guard, [this] { return pending.load() == 0; });
+    }
+
+    // Splits [begin, end) into chunks of `grain` and runs body(chunk_begin, chunk_end)
+    // on the pool, returning once every chunk is done. Call from outside the pool.
+    template <typename Body>
+    void ParallelFor(int begin, int end, int grain, Body&& body) {
+        for (int b = begin; b < end; b += grain) {
+            int e = b + grain < end ? b + grain : end;
+            Submit([&body, b, e] { body(b, e); });
+        }
+        Wait();
+    }
+
+    unsigned Size() const { return (unsigned)workers.size(); }
+};
@@ -0,0 +1,186 @@
+﻿/**
+ * @file Tracers.h
+ * @brief Massless tracer particles advected through the velocity field
+ *
+ * Particles are stored as structure-of-arrays and advanced with a midpoint (RK2)
+ * step using bilinear interpolation of ux/uy. Particles are interpolated in chunks
+ * of 64 through local arrays: cell indices and weights in one branch-free loop,
+ * then the four indexed loads per component in another. Both loops vectorize
+ * (with AVX2 the loads become gather instructions). Ranges of chunks are spread
+ * over the thread pool. Every few steps the particles are counting-sorted by cell
+ * so neighbouring particles read neighbouring velocity values.
+ */
+
+#pragma once
+
+#include "Lattice.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+class TracerSet {
+private:
+    std::vector<float> px, py;      // Positions in cell units
+    std::vector<int> pid;           // Stable particle id (survives sorting)
+    std::vector<float> sort_x, sort_y;
+    std::vector<int> sort_id, cell_start;
+    WorkStealingPool& pool;
+    int sort_interval;
+    int steps_since_sort;
+    int step;
+
+    // Deterministic per-particle random number in [0, 1), safe to call from any thread
+    static float Hash01(uint32_t a, uint32_t b) {
+        uint32_t h = a * 0x9E3779B1u ^ (b + 0x7F4A7C15u);
+        h ^= h >> 16;
+        h *= 0x85EBCA6Bu;
+        h ^= h >> 13;
+        h *= 0xC2B2AE35u;
+        h ^= h >> 16;
+        return (h >> 8) * (1.0f / 16777216.0f);
+    }
+
+    static constexpr int CHUNK = 64; // Particles interpolated together (lane loops over local arrays)
+
+    // Periodic wrap into [0, NY) for y in (-NY, 2 NY). Written without float compares:
+    // compilers keep those as branches (they may trap), which stops the lane loops vectorizing.
+    static float WrapY(float y) {
+        float s = y + NY;
+        return s - NY * (float)(int)(s * (1.0f / NY));
+    }
+
+    // Clamp to [lo, hi] as arithmetic, for the same reason (exact to rounding)
+    static float ClampArith(float x, float lo, float hi) {
+        return 0.5f * (lo + hi + std::fabs(x - lo) - std::fabs(x - hi));
+    }
+
+    // Bilinear interpolation of ux and uy at n <= CHUNK positions, periodic in y.
+    // Both components share the cell indices and weights.
+    static void SampleChunk(int n, const float* ux, const float* uy, const float* x, const float* y, float* u, float* v) {
+        alignas(32) int i00[CHUNK], i10[CHUNK];
+        alignas(32) float tx[CHUNK], ty[CHUNK];
+        for (int l = 0; l < n; l++) {
+            float cx = ClampArith(x[l], 0.0f, (float)(NX - 1) - 1e-3f);
+            float cy = WrapY(y[l]);
+            int x0 = (int)cx;
+            int y0 = std::min((int)cy, NY - 1);  // Rounding can leave cy at NY
+            int y1 = (y0 + 1) % NY;
+            tx[l] = cx - x0;
+            ty[l] = cy - y0;
+            i00[l] = y0 * NX + x0;
+            i10[l] = y1 * NX + x0;
+        }
+        for (int l = 0; l < n; l++) {
+            float a = ux[i00[l]] * (1 - tx[l]) + ux[i00[l] + 1] * tx[l];
+            float b = ux[i10[l]] * (1 - tx[l]) + ux[i10[l] + 1] * tx[l];
+            u[l] = a * (1 - ty[l]) + b * ty[l];
+        }
+        for (int l = 0; l < n; l++) {
+            float a = uy[i00[l]] * (1 - tx[l]) + uy[i00[l] + 1] * tx[l];
+            float b = uy[i10[l]] * (1 - tx[l]) + uy[i10[l] + 1] * tx[l];
+            v[l] = a * (1 - ty[l]) + b * ty[l];
+        }
+    }
+
+    void AdvectRange(int begin, int end, const float* ux, const float* uy, const std::vector<bool>& obstacle) {
+        for (int i = begin; i < end; i += CHUNK) {
+            int n = std::min(CHUNK, end - i);
+            alignas(32) float x[CHUNK], y[CHUNK], mx[CHUNK], my[CHUNK], u[CHUNK], v[CHUNK];
+            std::copy_n(&px[i], n, x);
+            std::copy_n(&py[i], n, y);
+
+            // Midpoint rule, one lattice time step
+            SampleChunk(n, ux, uy, x, y, u, v);
+            for (int l = 0; l < n; l++) {
+                mx[l] = x[l] + 0.5f * u[l];
+                my[l] = WrapY(y[l] + 0.5f * v[l]);
+            }
+            SampleChunk(n, ux, uy, mx, my, u, v);
+            for (int l = 0; l < n; l++) {
+                x[l] += u[l];
+                y[l] = WrapY(y[l] + v[l]);
+            }
+
+            // Particles leaving through the outlet or ending up inside a body restart at the inlet
+            for (int l = 0; l < n; l++) {
+                int j = i + l;
+                bool lost = x[l] < 0.0f || x[l] >= NX - 1 || obstacle[idx((int)x[l], std::min((int)y[l], NY - 1))];
+                if (lost) {
+                    x[l] = Hash01(pid[j], step) * 2.0f;
+                    y[l] = Hash01(pid[j] + 0x51ED27u, step) * (NY - 1);
+                }
+                px[j] = x[l];
+                py[j] = y[l];
+            }
+        }
+    }
+
+    // Counting sort by cell index: O(particles + cells), no comparisons
+    void SortByCell() {
+        int n = (int)px.size();
+        cell_start.assign(NX * NY + 1, 0);
+        for (int i = 0; i < n; i++) cell_start[idx((int)px[i], std::min((int)py[i], NY - 1)) + 1]++;
+        for (int c = 0; c < NX * NY; c++) cell_start[c + 1] += cell_start[c];
+
+        sort_x.resize(n);
+        sort_y.resize(n);
+        sort_id.resize(n);
+        for (int i = 0; i < n; i++) {
+            int dst = cell_start[idx((int)px[i], std::min((int)py[i], NY - 1))]++;
+            sort_x[dst] = px[i];
+            sort_y[dst] = py[i];
+            sort_id[dst] = pid[i];
+        }
+        px.swap(sort_x);
+        py.swap(sort_y);
+        pid.swap(sort_id);
+    }
+
+public:
+    TracerSet(WorkStealingPool& workers, int sort_every = 32)
+        : pool(workers), sort_interval(sort_every), steps_since_sort(0), step(0) {}
+
+    // Scatters `count` particles uniformly over the fluid cells
+    void Seed(int count, const std::vector<bool>& obstacle) {
+        px.clear();
+        py.clear();
+        pid.clear();
+        for (uint32_t attempt = 0; (int)px.size() < count; attempt++) {
+            float x = Hash01(attempt, 1) * (NX - 1);
+            float y = Hash01(attempt, 2) * (NY - 1);
+            if (obstacle[idx((int)x, (int)y)]) continue;
+            px.push_back(x);
+            py.push_back(y);
+            pid.push_back((int)px.size() - 1);
+        }
+        SortByCell();
+    }
+
+    // Advances every particle by one lattice time step through (ux, uy)
+    void Advect(const float* ux, const float* uy, const std::vector<bool>& obstacle) {
+        int n = (int)px.size();
+        int grain = std::max(4096, n / (int)(pool.Size() * 4)) / CHUNK * CHUNK; // Whole chunks per task
+        pool.ParallelFor(0, n, grain, [&](int begin, int end) { AdvectRange(begin, end, ux, uy, obstacle); });
+        step++;
+
+        if (++steps_since_sort >= sort_interval) {
+            steps_since_sort = 0;
+            SortByCell();
+        }
+    }
+
+    // Writes step,id,x,y for every particle whose id is a multiple of `stride`
+    void WriteTrajectories(std::ostream& out, int stride) const {
+        for (size_t i = 0; i < px.size(); i++) {
+            if (pid[i] % stride != 0) continue;
+            out << step << "," << pid[i] << "," << px[i] << "," << py[i] << "\n";
+        }
+    }
+
+    int Size() const { return (int)px.size(); }
+    const std::vector<float>& X() const { return px; }
+    const std::vector<float>& Y() const { return py; }
+};